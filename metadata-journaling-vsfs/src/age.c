@@ -0,0 +1,442 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blockdev.h"
+
+#define FS_MAGIC 0x56534653U
+
+#define BLOCK_SIZE        4096U
+#define INODE_SIZE         128U
+#define JOURNAL_BLOCK_IDX    1U
+#define JOURNAL_BLOCKS      16U
+#define INODE_BLOCKS         2U
+#define DATA_BLOCKS         64U
+#define INODE_BMAP_IDX     (JOURNAL_BLOCK_IDX + JOURNAL_BLOCKS)
+#define DATA_BMAP_IDX      (INODE_BMAP_IDX + 1U)
+#define INODE_START_IDX    (DATA_BMAP_IDX + 1U)
+#define DATA_START_IDX     (INODE_START_IDX + INODE_BLOCKS)
+#define TOTAL_BLOCKS       (DATA_START_IDX + DATA_BLOCKS)
+#define INODE_COUNT        (INODE_BLOCKS * (BLOCK_SIZE / INODE_SIZE))
+#define DIRECT_POINTERS     8U
+#define DIRENTS_PER_BLOCK  (BLOCK_SIZE / sizeof(struct dirent))
+#define DEFAULT_IMAGE "vsfs.img"
+
+#define FS_STATE_CLEAN 0x1U
+
+struct superblock {
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t inode_count;
+
+    uint32_t journal_block;
+    uint32_t inode_bitmap;
+    uint32_t data_bitmap;
+    uint32_t inode_start;
+    uint32_t data_start;
+
+    uint32_t state;
+    uint32_t checkpoint_seq;
+    uint32_t install_gen;
+
+    uint8_t  _pad[128 - 12 * 4];
+};
+
+struct inode {
+    uint16_t type;
+    uint16_t links;
+    uint32_t size;
+
+    uint32_t direct[DIRECT_POINTERS];
+
+    uint32_t ctime;
+    uint32_t mtime;
+
+    uint8_t _pad[128 - (2 + 2 + 4 + DIRECT_POINTERS * 4 + 4 + 4)];
+};
+
+struct dirent {
+    uint32_t inode;
+    char name[28];
+};
+
+_Static_assert(sizeof(struct superblock) == 128, "superblock must be 128 bytes");
+_Static_assert(sizeof(struct inode) == 128, "inode must be 128 bytes");
+_Static_assert(sizeof(struct dirent) == 32, "dirent must be 32 bytes");
+
+// The whole image is aged in memory and written back once.
+struct fs {
+    uint8_t blocks[TOTAL_BLOCKS][BLOCK_SIZE];
+    struct superblock *sb;
+    uint8_t *inode_bitmap;
+    uint8_t *data_bitmap;
+    struct inode *inodes;
+    struct inode *root;
+    struct dirent *dir;
+};
+
+struct age_params {
+    uint64_t seed;
+    double fill;       // target fraction of data blocks in use
+    double frag;       // target fraction of non-contiguous block steps in multi-block files
+    double max_inodes; // never use more than this fraction of inodes
+    uint32_t max_ops;
+};
+
+struct age_stats {
+    uint32_t creates, deletes, renames, writes;
+};
+
+static uint64_t rng_state;
+
+static void die(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+// xorshift64*: small, fast and identical on every platform for a given seed.
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t rng_below(uint32_t n) {
+    return n ? (uint32_t)(rng_next() % n) : 0;
+}
+
+static int bitmap_test(const uint8_t *bitmap, uint32_t index) {
+    return (bitmap[index / 8] >> (index % 8)) & 0x1;
+}
+
+static void bitmap_set(uint8_t *bitmap, uint32_t index) {
+    bitmap[index / 8] |= (uint8_t)(1U << (index % 8));
+}
+
+static void bitmap_clear(uint8_t *bitmap, uint32_t index) {
+    bitmap[index / 8] &= (uint8_t)~(1U << (index % 8));
+}
+
+/* -------------------- accounting -------------------- */
+
+static uint32_t data_used(const struct fs *fs) {
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < DATA_BLOCKS; ++i) {
+        used += (uint32_t)bitmap_test(fs->data_bitmap, i);
+    }
+    return used;
+}
+
+static uint32_t inodes_used(const struct fs *fs) {
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < INODE_COUNT; ++i) {
+        used += fs->inodes[i].type != 0;
+    }
+    return used;
+}
+
+static double fragmentation(const struct fs *fs) {
+    uint32_t steps = 0, breaks = 0;
+    for (uint32_t i = 1; i < INODE_COUNT; ++i) {
+        const struct inode *ino = &fs->inodes[i];
+        if (ino->type != 1) {
+            continue;
+        }
+        for (uint32_t d = 1; d < DIRECT_POINTERS && ino->direct[d] != 0; ++d) {
+            steps++;
+            breaks += ino->direct[d] != ino->direct[d - 1] + 1;
+        }
+    }
+    return steps ? (double)breaks / steps : 0.0;
+}
+
+/* -------------------- operations -------------------- */
+
+// First fit, like a simple allocator would: freed holes are reused before
+// the tail, which is what breaks files apart over time.
+static uint32_t alloc_block(struct fs *fs) {
+    for (uint32_t i = 0; i < DATA_BLOCKS; ++i) {
+        if (!bitmap_test(fs->data_bitmap, i)) {
+            bitmap_set(fs->data_bitmap, i);
+            return DATA_START_IDX + i;
+        }
+    }
+    return 0;
+}
+
+static void fill_block(struct fs *fs, uint32_t blk) {
+    for (uint32_t i = 0; i < BLOCK_SIZE; i += 8) {
+        uint64_t v = rng_next();
+        memcpy(&fs->blocks[blk][i], &v, sizeof(v));
+    }
+}
+
+static uint32_t block_count(const struct inode *ino) {
+    return (ino->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+// Grows a file by up to `extra` blocks and gives it a size its blocks cover.
+static void grow_file(struct fs *fs, struct inode *ino, uint32_t extra) {
+    uint32_t have = block_count(ino);
+    uint32_t want = have + extra > DIRECT_POINTERS ? DIRECT_POINTERS : have + extra;
+    for (uint32_t d = have; d < want; ++d) {
+        uint32_t blk = alloc_block(fs);
+        if (blk == 0) {
+            want = d;
+            break;
+        }
+        ino->direct[d] = blk;
+        fill_block(fs, blk);
+    }
+    if (want > have) {
+        ino->size = (want - 1) * BLOCK_SIZE + 1 + rng_below(BLOCK_SIZE);
+    }
+    ino->mtime = (uint32_t)time(NULL);
+}
+
+static int random_file(const struct fs *fs) {
+    uint32_t start = 1 + rng_below(INODE_COUNT - 1);
+    for (uint32_t k = 0; k < INODE_COUNT - 1; ++k) {
+        uint32_t i = 1 + (start - 1 + k) % (INODE_COUNT - 1);
+        if (fs->inodes[i].type == 1) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int dirent_of(const struct fs *fs, uint32_t inum) {
+    for (uint32_t e = 0; e < fs->root->size / sizeof(struct dirent); ++e) {
+        if (fs->dir[e].inode == inum && fs->dir[e].name[0] != '\0') {
+            return (int)e;
+        }
+    }
+    return -1;
+}
+
+static void random_name(char *name, size_t len) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    snprintf(name, len, "f%08x", (uint32_t)rng_next());
+    for (size_t i = 9; i < len - 1 && rng_below(3) != 0; ++i) {
+        name[i] = alphabet[rng_below(sizeof(alphabet) - 1)];
+        name[i + 1] = '\0';
+    }
+}
+
+static int op_create(struct fs *fs) {
+    uint32_t inum = 0;
+    for (uint32_t i = 1; i < INODE_COUNT; ++i) {
+        if (fs->inodes[i].type == 0) {
+            inum = i;
+            break;
+        }
+    }
+    // Reuse a hole left by a delete before extending the directory.
+    uint32_t entries = fs->root->size / sizeof(struct dirent);
+    uint32_t slot = entries;
+    for (uint32_t e = 2; e < entries; ++e) {
+        if (fs->dir[e].inode == 0 && fs->dir[e].name[0] == '\0') {
+            slot = e;
+            break;
+        }
+    }
+    if (inum == 0 || slot >= DIRENTS_PER_BLOCK) {
+        return 0;
+    }
+
+    struct inode *ino = &fs->inodes[inum];
+    memset(ino, 0, sizeof(*ino));
+    ino->type = 1;
+    ino->links = 1;
+    ino->ctime = ino->mtime = (uint32_t)time(NULL);
+    grow_file(fs, ino, rng_below(4));
+    bitmap_set(fs->inode_bitmap, inum);
+
+    memset(&fs->dir[slot], 0, sizeof(struct dirent));
+    fs->dir[slot].inode = inum;
+    random_name(fs->dir[slot].name, sizeof(fs->dir[slot].name));
+    if (slot == entries) {
+        fs->root->size += sizeof(struct dirent);
+    }
+    fs->root->mtime = (uint32_t)time(NULL);
+    return 1;
+}
+
+static int op_delete(struct fs *fs) {
+    int inum = random_file(fs);
+    if (inum < 0) {
+        return 0;
+    }
+    struct inode *ino = &fs->inodes[inum];
+    for (uint32_t d = 0; d < DIRECT_POINTERS; ++d) {
+        if (ino->direct[d] != 0) {
+            bitmap_clear(fs->data_bitmap, ino->direct[d] - DATA_START_IDX);
+        }
+    }
+    memset(ino, 0, sizeof(*ino));
+    bitmap_clear(fs->inode_bitmap, (uint32_t)inum);
+    int e = dirent_of(fs, (uint32_t)inum);
+    if (e >= 0) {
+        memset(&fs->dir[e], 0, sizeof(struct dirent));
+    }
+    fs->root->mtime = (uint32_t)time(NULL);
+    return 1;
+}
+
+static int op_rename(struct fs *fs) {
+    int inum = random_file(fs);
+    int e = inum < 0 ? -1 : dirent_of(fs, (uint32_t)inum);
+    if (e < 0) {
+        return 0;
+    }
+    random_name(fs->dir[e].name, sizeof(fs->dir[e].name));
+    fs->root->mtime = (uint32_t)time(NULL);
+    return 1;
+}
+
+static int op_write(struct fs *fs) {
+    int inum = random_file(fs);
+    if (inum < 0 || block_count(&fs->inodes[inum]) >= DIRECT_POINTERS) {
+        return 0;
+    }
+    grow_file(fs, &fs->inodes[inum], 1 + rng_below(2));
+    return 1;
+}
+
+/* -------------------- driver -------------------- */
+
+static void load_fs(blockdev_t *dev, struct fs *fs) {
+    for (uint32_t b = 0; b < TOTAL_BLOCKS; ++b) {
+        if (bdev_read(dev, b, fs->blocks[b]) != 0) {
+            die("pread");
+        }
+    }
+    fs->sb = (struct superblock *)fs->blocks[0];
+    fs->inode_bitmap = fs->blocks[INODE_BMAP_IDX];
+    fs->data_bitmap = fs->blocks[DATA_BMAP_IDX];
+    fs->inodes = (struct inode *)fs->blocks[INODE_START_IDX];
+    fs->root = &fs->inodes[0];
+    fs->dir = (struct dirent *)fs->blocks[fs->root->direct[0]];
+}
+
+static void store_fs(blockdev_t *dev, struct fs *fs) {
+    for (uint32_t b = 0; b < TOTAL_BLOCKS; ++b) {
+        if (bdev_write(dev, b, fs->blocks[b]) != 0) {
+            die("pwrite");
+        }
+    }
+    if (bdev_sync(dev) < 0) {
+        die("fsync");
+    }
+}
+
+static void age(struct fs *fs, const struct age_params *p, struct age_stats *st) {
+    uint32_t fill_target = (uint32_t)(p->fill * DATA_BLOCKS + 0.5);
+    uint32_t inode_cap = (uint32_t)(p->max_inodes * INODE_COUNT);
+    for (uint32_t op = 0; op < p->max_ops; ++op) {
+        uint32_t used = data_used(fs);
+        if (used + 1 >= fill_target && used <= fill_target && fragmentation(fs) >= p->frag) {
+            break;
+        }
+        // Lean towards whichever direction moves the fill level to the target,
+        // and keep churning around it until the fragmentation target is met.
+        uint32_t r = rng_below(100);
+        int grow = used < fill_target;
+        if (r < 10) {
+            st->renames += (uint32_t)op_rename(fs);
+        } else if (grow ? r < 30 : r < 70) {
+            st->deletes += (uint32_t)op_delete(fs);
+        } else if (r < 85 && inodes_used(fs) < inode_cap) {
+            st->creates += (uint32_t)op_create(fs);
+        } else {
+            st->writes += (uint32_t)op_write(fs);
+        }
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [image] [--fill <pct>] [--frag <pct>] [--max-inodes <pct>] [--seed <n>] [--max-ops <n>]\n"
+            "  --fill        target share of data blocks in use (default 50)\n"
+            "  --frag        minimum share of non-contiguous steps within files (default 30)\n"
+            "  --max-inodes  leave the rest of the inodes free for benchmarks (default 75)\n"
+            "  --seed        PRNG seed; recorded in <image>.age (default: time and pid)\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *image_path = DEFAULT_IMAGE;
+    struct age_params p = {
+        .seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32),
+        .fill = 0.50,
+        .frag = 0.30,
+        .max_inodes = 0.75,
+        .max_ops = 100000,
+    };
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--fill") == 0 && i + 1 < argc) {
+            p.fill = atof(argv[++i]) / 100.0;
+        } else if (strcmp(argv[i], "--frag") == 0 && i + 1 < argc) {
+            p.frag = atof(argv[++i]) / 100.0;
+        } else if (strcmp(argv[i], "--max-inodes") == 0 && i + 1 < argc) {
+            p.max_inodes = atof(argv[++i]) / 100.0;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            p.seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--max-ops") == 0 && i + 1 < argc) {
+            p.max_ops = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            image_path = argv[i];
+        }
+    }
+    rng_state = p.seed ? p.seed : 1;
+
+    blockdev_t *dev = bdev_open(image_path, BDEV_RDWR, 0);
+    if (!dev) {
+        die("open");
+    }
+    struct fs *fs = malloc(sizeof(*fs));
+    if (!fs) {
+        die("malloc image");
+    }
+    load_fs(dev, fs);
+    if (fs->sb->magic != FS_MAGIC || !(fs->sb->state & FS_STATE_CLEAN)) {
+        fprintf(stderr, "age: '%s' must be a clean VSFS image (run ./journal install first)\n", image_path);
+        return 1;
+    }
+
+    struct age_stats st = {0};
+    age(fs, &p, &st);
+    store_fs(dev, fs);
+    bdev_close(dev);
+
+    uint32_t used = data_used(fs);
+    double frag = fragmentation(fs);
+    uint32_t files = inodes_used(fs) - 1;
+    printf("age: '%s' seed %llu: %u create(s), %u delete(s), %u rename(s), %u write(s)\n", image_path,
+           (unsigned long long)p.seed, st.creates, st.deletes, st.renames, st.writes);
+    printf("age: %u file(s), data %u/%u block(s) (%.0f%%), fragmentation %.0f%%\n", files, used, DATA_BLOCKS,
+           100.0 * used / DATA_BLOCKS, 100.0 * frag);
+
+    char record[4096];
+    snprintf(record, sizeof(record), "%s.age", image_path);
+    FILE *rf = fopen(record, "w");
+    if (!rf) {
+        die("open age record");
+    }
+    fprintf(rf, "seed=%llu\nfill_target=%.2f\nfrag_target=%.2f\nmax_inodes=%.2f\nfiles=%u\ndata_used=%u\n"
+                "fragmentation=%.4f\n",
+            (unsigned long long)p.seed, p.fill, p.frag, p.max_inodes, files, used, frag);
+    fclose(rf);
+    free(fs);
+    return 0;
+}
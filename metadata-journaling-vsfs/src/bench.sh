@@ -0,0 +1,133 @@
+#!/bin/sh
+# Benchmark suite: records one create/install workload on a fresh image, then
+# replays it with `journal run-trace --max-speed` against a fresh image and
+# against images aged to 50, 90 and 99% full, and validates each result.
+# Every run appends create throughput, install time and validation time per
+# image to <workdir>/results.tsv; --save keeps that as a baseline and
+# --compare checks it against one with benchcmp. Recording and replays
+# checkpoint as the journal fills (VSFS_COMPACT), so every image runs the
+# recorded operations with the recorded outcomes; a replay whose outcomes
+# still differ fails the suite.
+#
+# usage: bench.sh [--runs <n>] [--save <baseline>] [--compare <baseline>] [workdir]
+#   BIN   directory holding mkfs, journal, age, validator and benchcmp
+#         (default: directory of this script)
+#   SEED  aging seed, so runs are comparable (default 1)
+#   OPS   creates in the recorded workload (default 12)
+#   VALIDATE_LOOPS  validator runs timed per sample (default 20)
+#   BDEV  block-device backend for the timed replays and validations
+#         (default: $VSFS_BDEV, else file); `ram` leaves out device latency,
+#         which makes comparisons much less noisy
+set -eu
+
+BIN=${BIN:-$(cd "$(dirname "$0")" && pwd)}
+SEED=${SEED:-1}
+OPS=${OPS:-12}
+VALIDATE_LOOPS=${VALIDATE_LOOPS:-20}
+BDEV=${BDEV:-${VSFS_BDEV:-file}}
+unset VSFS_BDEV # recording and aging must reach the images
+RUNS=1
+SAVE=
+COMPARE=
+WORK=bench.out
+while [ $# -gt 0 ]; do
+    case $1 in
+        --runs) RUNS=$2; shift 2 ;;
+        --save) SAVE=$2; shift 2 ;;
+        --compare) COMPARE=$2; shift 2 ;;
+        -*) echo "usage: bench.sh [--runs <n>] [--save <baseline>] [--compare <baseline>] [workdir]" >&2; exit 2 ;;
+        *) WORK=$1; shift ;;
+    esac
+done
+if [ -n "$SAVE$COMPARE" ] && [ "$RUNS" -lt 2 ]; then
+    echo "bench: --save and --compare need --runs 2 or more for confidence intervals" >&2
+    exit 2
+fi
+mkdir -p "$WORK"
+
+# Record the workload once; creates checkpoint as the journal fills, so every
+# recorded create succeeds.
+"$BIN/mkfs" "$WORK/record.img" >/dev/null
+rm -f "$WORK/workload.trace"
+i=1
+while [ "$i" -le "$OPS" ]; do
+    VSFS_TRACE="$WORK/workload.trace" VSFS_COMPACT=1 "$BIN/journal" -f "$WORK/record.img" create "bench_$i" \
+        >/dev/null 2>&1
+    i=$((i + 1))
+done
+VSFS_TRACE="$WORK/workload.trace" "$BIN/journal" -f "$WORK/record.img" install >/dev/null
+
+# Age each starting image once; every run replays onto a fresh copy of it.
+for fill in fresh 50 90 99; do
+    "$BIN/mkfs" "$WORK/$fill.base.img" >/dev/null
+    if [ "$fill" != fresh ]; then
+        "$BIN/age" "$WORK/$fill.base.img" --fill "$fill" --seed "$SEED" | sed "s/^/[$fill] /"
+    fi
+done
+
+RESULTS="$WORK/results.tsv"
+{
+    echo "# vsfs-bench 1"
+    echo "# date=$(date -u +%Y-%m-%dT%H:%M:%SZ) seed=$SEED ops=$OPS runs=$RUNS validate_loops=$VALIDATE_LOOPS bdev=$BDEV"
+    printf 'metric\tworkload\trun\tvalue\n'
+} > "$RESULTS"
+
+failed=0
+run=1
+while [ "$run" -le "$RUNS" ]; do
+    for fill in fresh 50 90 99; do
+        img="$WORK/$fill.img"
+        cp "$WORK/$fill.base.img" "$img"
+        # Aged images use more inode table blocks per create and so fill the
+        # journal sooner than the recording did.
+        VSFS_BDEV=$BDEV VSFS_COMPACT=1 "$BIN/journal" -f "$img" run-trace "$WORK/workload.trace" --max-speed \
+            > "$WORK/$fill.trace.out" 2>&1
+        # "run-trace: recorded run spent 0.009s in operations; 0 outcome(s) differ ..."
+        n=$(awk '/outcome\(s\) differ/ { for (i = 1; i < NF; i++) if ($(i + 1) == "outcome(s)") print $i }' \
+            "$WORK/$fill.trace.out")
+        if [ "${n:-0}" != 0 ]; then
+            echo "bench: [$fill] run $run: $n outcome(s) differ from the recording; see $WORK/$fill.trace.out" >&2
+            failed=1
+        fi
+        # "  create       14 op(s)  mean      9.5us  p50 ..."
+        create_us=$(awk '$1 == "create" { sub(/us$/, "", $5); print $5 }' "$WORK/$fill.trace.out")
+        install_us=$(awk '$1 == "install" { sub(/us$/, "", $5); print $5 }' "$WORK/$fill.trace.out")
+        if [ -z "$create_us" ] || [ -z "$install_us" ]; then
+            echo "bench: [$fill] run $run: no create or install latency; see $WORK/$fill.trace.out" >&2
+            failed=1
+        fi
+
+        # One validator run is far shorter than process startup noise, so
+        # each sample is the mean over VALIDATE_LOOPS runs.
+        "$BIN/validator" "$img" > "$WORK/$fill.validate.out"
+        start=$(date +%s%N)
+        i=1
+        while [ "$i" -le "$VALIDATE_LOOPS" ]; do
+            VSFS_BDEV=$BDEV "$BIN/validator" "$img" >/dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+
+        awk -v run="$run" -v fill="$fill" -v c="$create_us" -v ins="$install_us" \
+            -v ns=$((end - start)) -v loops="$VALIDATE_LOOPS" 'BEGIN {
+            if (c != "" && c > 0) printf "create_ops_per_s\t%s\t%d\t%.1f\n", fill, run, 1e6 / c
+            if (ins != "") printf "install_us\t%s\t%d\t%s\n", fill, run, ins
+            printf "validate_us\t%s\t%d\t%.1f\n", fill, run, ns / 1000 / loops
+        }' >> "$RESULTS"
+        printf '[%s] run %d: create %s us/op, install %s us/op, %s\n' "$fill" "$run" \
+            "${create_us:-?}" "${install_us:-?}" "$(tail -n 1 "$WORK/$fill.validate.out")"
+    done
+    run=$((run + 1))
+done
+
+if [ "$failed" != 0 ]; then
+    echo "bench: replays did not run the recorded workload; not saving or comparing" >&2
+    exit 1
+fi
+if [ -n "$SAVE" ]; then
+    cp "$RESULTS" "$SAVE"
+    echo "bench: saved baseline to $SAVE"
+fi
+if [ -n "$COMPARE" ]; then
+    exec "$BIN/benchcmp" "$COMPARE" "$RESULTS"
+fi
@@ -0,0 +1,223 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SERIES  64
+#define MAX_SAMPLES 256
+#define NAME_LEN    48
+#define DEFAULT_THRESHOLD 2.0 // percent; smaller significant changes are reported but not flagged
+
+// All samples of one metric on one workload, from one results file.
+struct series {
+    char metric[NAME_LEN];
+    char workload[NAME_LEN];
+    double v[MAX_SAMPLES];
+    int n;
+};
+
+struct results {
+    const char *path;
+    struct series s[MAX_SERIES];
+    int n;
+};
+
+struct summary {
+    double mean;
+    double var; // sample variance
+    int n;
+};
+
+static void die(const char *msg) {
+    perror(msg);
+    exit(2);
+}
+
+static struct series *find_series(struct results *r, const char *metric, const char *workload) {
+    for (int i = 0; i < r->n; ++i) {
+        if (strcmp(r->s[i].metric, metric) == 0 && strcmp(r->s[i].workload, workload) == 0) {
+            return &r->s[i];
+        }
+    }
+    return NULL;
+}
+
+// Reads the tab-separated "metric workload run value" rows written by
+// bench.sh; '#' comments and the column header are skipped.
+static void load_results(struct results *r, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        die(path);
+    }
+    r->path = path;
+    r->n = 0;
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (line[0] == '#' || line[0] == '\n' || strncmp(line, "metric\t", 7) == 0) {
+            continue;
+        }
+        char metric[NAME_LEN], workload[NAME_LEN];
+        int run;
+        double value;
+        if (sscanf(line, "%47s %47s %d %lf", metric, workload, &run, &value) != 4) {
+            fprintf(stderr, "%s:%d: malformed result\n", path, lineno);
+            exit(2);
+        }
+        struct series *s = find_series(r, metric, workload);
+        if (!s) {
+            if (r->n == MAX_SERIES) {
+                fprintf(stderr, "%s: more than %d series\n", path, MAX_SERIES);
+                exit(2);
+            }
+            s = &r->s[r->n++];
+            snprintf(s->metric, sizeof(s->metric), "%s", metric);
+            snprintf(s->workload, sizeof(s->workload), "%s", workload);
+            s->n = 0;
+        }
+        if (s->n == MAX_SAMPLES) {
+            fprintf(stderr, "%s: more than %d samples of %s/%s\n", path, MAX_SAMPLES, metric, workload);
+            exit(2);
+        }
+        s->v[s->n++] = value;
+    }
+    fclose(f);
+}
+
+static struct summary summarize(const struct series *s) {
+    struct summary m = {0, 0, s->n};
+    for (int i = 0; i < s->n; ++i) {
+        m.mean += s->v[i];
+    }
+    m.mean /= s->n;
+    for (int i = 0; i < s->n; ++i) {
+        m.var += (s->v[i] - m.mean) * (s->v[i] - m.mean);
+    }
+    m.var = s->n > 1 ? m.var / (s->n - 1) : 0;
+    return m;
+}
+
+// Two-sided 95% critical value of Student's t. Fractional degrees of
+// freedom round down, which only widens the interval.
+static double t95(double df) {
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if (df < 1) {
+        return table[0];
+    }
+    if (df < 31) {
+        return table[(int)df - 1];
+    }
+    return df < 40 ? 2.042 : df < 60 ? 2.021 : df < 120 ? 2.000 : df < 1000 ? 1.980 : 1.960;
+}
+
+// Throughputs ("..._per_s") regress downwards, times regress upwards.
+static int higher_is_better(const char *metric) {
+    size_t len = strlen(metric);
+    return len >= 6 && strcmp(metric + len - 6, "_per_s") == 0;
+}
+
+// Prints one comparison row and returns 1 if it is a regression, -1 if
+// either side has too few runs to tell.
+static int compare_series(const struct series *base, const struct series *cur, double threshold) {
+    struct summary b = summarize(base), c = summarize(cur);
+    printf("%-18s %-8s %12.1f ±%9.1f %12.1f ±%9.1f ", base->metric, base->workload, b.mean,
+           b.n > 1 ? t95(b.n - 1) * sqrt(b.var / b.n) : 0.0, c.mean,
+           c.n > 1 ? t95(c.n - 1) * sqrt(c.var / c.n) : 0.0);
+    if (b.n < 2 || c.n < 2 || b.mean == 0) {
+        printf("%+7.1f%%  (need 2+ runs on each side)\n", b.mean ? 100 * (c.mean - b.mean) / b.mean : 0.0);
+        return -1;
+    }
+
+    // Welch's t interval for the difference of means, as % of the baseline.
+    double vb = b.var / b.n, vc = c.var / c.n;
+    double se = sqrt(vb + vc);
+    double df = se > 0 ? (vb + vc) * (vb + vc) / (vb * vb / (b.n - 1) + vc * vc / (c.n - 1)) : 1e9;
+    double diff = c.mean - b.mean;
+    double change = 100 * diff / b.mean;
+    double half = 100 * t95(df) * se / fabs(b.mean);
+
+    // Slowdown is positive when the current build is worse.
+    double sign = higher_is_better(base->metric) ? -1 : 1;
+    double slow = sign * change, slow_lo = slow - half;
+    const char *verdict = "";
+    int regressed = 0;
+    if (slow_lo > 0 && slow >= threshold) {
+        verdict = "REGRESSION";
+        regressed = 1;
+    } else if (slow_lo > 0) {
+        verdict = "slower (below threshold)";
+    } else if (slow + half < 0) {
+        verdict = "faster";
+    }
+    printf("%+7.1f%% [%+6.1f%%, %+6.1f%%]  %s\n", change, change - half, change + half, verdict);
+    return regressed;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [--threshold <pct>] <baseline.tsv> <current.tsv>\n"
+            "  --threshold  smallest significant slowdown that fails the check (default %.0f%%)\n",
+            prog, DEFAULT_THRESHOLD);
+}
+
+int main(int argc, char *argv[]) {
+    double threshold = DEFAULT_THRESHOLD;
+    const char *paths[2];
+    int npaths = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = strtod(argv[++i], NULL);
+        } else if (argv[i][0] != '-' && npaths < 2) {
+            paths[npaths++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (npaths != 2) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    static struct results base, cur;
+    load_results(&base, paths[0]);
+    load_results(&cur, paths[1]);
+
+    printf("%-18s %-8s %24s %24s %s\n", "metric", "workload", "baseline (mean ± 95% CI)",
+           "current (mean ± 95% CI)", "change [95% CI]");
+    // A series that vanished or cannot be judged fails the check too: a
+    // broken operation must not pass by dropping out of the results.
+    int regressions = 0, missing = 0, unjudged = 0;
+    for (int i = 0; i < base.n; ++i) {
+        const struct series *c = find_series(&cur, base.s[i].metric, base.s[i].workload);
+        if (!c) {
+            printf("%-18s %-8s missing from %s\n", base.s[i].metric, base.s[i].workload, cur.path);
+            missing++;
+            continue;
+        }
+        int r = compare_series(&base.s[i], c, threshold);
+        if (r < 0) {
+            unjudged++;
+        } else {
+            regressions += r;
+        }
+    }
+    for (int i = 0; i < cur.n; ++i) {
+        if (!find_series(&base, cur.s[i].metric, cur.s[i].workload)) {
+            printf("%-18s %-8s not in baseline\n", cur.s[i].metric, cur.s[i].workload);
+        }
+    }
+
+    if (regressions || missing || unjudged) {
+        printf("benchcmp: %d regression(s) beyond %.1f%%, %d series missing, %d with too few runs\n", regressions,
+               threshold, missing, unjudged);
+        return 1;
+    }
+    printf("benchcmp: no significant regressions\n");
+    return 0;
+}
@@ -0,0 +1,460 @@
+#define _GNU_SOURCE // O_DIRECT
+#include "blockdev.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define BDEV_HAVE_URING 1
+#endif
+#endif
+
+// I/O log format, shared with crashsim.
+#define IOLOG_MAGIC   0x4f495356U // "VSIO"
+#define IOLOG_VERSION 1U
+#define IOLOG_WRITE   1U
+#define IOLOG_BARRIER 2U
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} iolog_header_t;
+
+typedef struct {
+    uint32_t op;
+    uint32_t block_no; // IOLOG_WRITE only; a block of data follows
+} iolog_rec_t;
+
+struct bdev_ops {
+    const char *name;
+    int (*open)(blockdev_t *dev, const char *path, int flags);
+    int (*read)(blockdev_t *dev, uint32_t block_no, void *buf);
+    int (*write)(blockdev_t *dev, uint32_t block_no, const void *buf);
+    int (*sync)(blockdev_t *dev);
+    void (*close)(blockdev_t *dev);
+};
+
+#ifdef BDEV_HAVE_URING
+struct uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_len, cq_ring_len, sqes_len;
+};
+#endif
+
+struct blockdev {
+    const struct bdev_ops *ops;
+    int fd;
+    uint32_t nblocks;
+    uint8_t *mem; // mmap and ram: the image; direct: the bounce buffer
+    int iolog_fd;
+#ifdef BDEV_HAVE_URING
+    struct uring ring;
+#endif
+};
+
+static int short_io(void) {
+    errno = EIO;
+    return -1;
+}
+
+static int in_range(const blockdev_t *dev, uint32_t block_no) {
+    if (block_no >= dev->nblocks) {
+        errno = ENXIO;
+        return 0;
+    }
+    return 1;
+}
+
+// Opens the image file and settles its size in blocks.
+static int open_file(blockdev_t *dev, const char *path, int flags, int extra) {
+    int oflags = (flags & (BDEV_RDWR | BDEV_CREATE)) ? O_RDWR : O_RDONLY;
+    if (flags & BDEV_CREATE) {
+        oflags |= O_CREAT | O_TRUNC;
+    }
+    dev->fd = open(path, oflags | extra, 0644);
+    if (dev->fd < 0) {
+        return -1;
+    }
+    if (flags & BDEV_CREATE) {
+        return ftruncate(dev->fd, (off_t)dev->nblocks * BDEV_BLOCK_SIZE);
+    }
+    struct stat st;
+    if (fstat(dev->fd, &st) < 0) {
+        return -1;
+    }
+    dev->nblocks = (uint32_t)(st.st_size / BDEV_BLOCK_SIZE);
+    return 0;
+}
+
+static void close_file(blockdev_t *dev) {
+    if (dev->fd >= 0) {
+        close(dev->fd);
+    }
+}
+
+/* -------------------- file -------------------- */
+
+static int file_open(blockdev_t *dev, const char *path, int flags) {
+    return open_file(dev, path, flags, 0);
+}
+
+static int file_read(blockdev_t *dev, uint32_t block_no, void *buf) {
+    ssize_t n = pread(dev->fd, buf, BDEV_BLOCK_SIZE, (off_t)block_no * BDEV_BLOCK_SIZE);
+    return n == (ssize_t)BDEV_BLOCK_SIZE ? 0 : n < 0 ? -1 : short_io();
+}
+
+static int file_write(blockdev_t *dev, uint32_t block_no, const void *buf) {
+    ssize_t n = pwrite(dev->fd, buf, BDEV_BLOCK_SIZE, (off_t)block_no * BDEV_BLOCK_SIZE);
+    return n == (ssize_t)BDEV_BLOCK_SIZE ? 0 : n < 0 ? -1 : short_io();
+}
+
+static int file_sync(blockdev_t *dev) {
+    return fsync(dev->fd);
+}
+
+/* -------------------- mmap -------------------- */
+
+static int mmap_open(blockdev_t *dev, const char *path, int flags) {
+    if (open_file(dev, path, flags, 0) < 0) {
+        return -1;
+    }
+    if (dev->nblocks == 0) {
+        return 0;
+    }
+    int prot = PROT_READ | ((flags & (BDEV_RDWR | BDEV_CREATE)) ? PROT_WRITE : 0);
+    void *map = mmap(NULL, (size_t)dev->nblocks * BDEV_BLOCK_SIZE, prot, MAP_SHARED, dev->fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    dev->mem = map;
+    return 0;
+}
+
+static int mem_read(blockdev_t *dev, uint32_t block_no, void *buf) {
+    if (!in_range(dev, block_no)) {
+        return -1;
+    }
+    memcpy(buf, dev->mem + (size_t)block_no * BDEV_BLOCK_SIZE, BDEV_BLOCK_SIZE);
+    return 0;
+}
+
+static int mem_write(blockdev_t *dev, uint32_t block_no, const void *buf) {
+    if (!in_range(dev, block_no)) {
+        return -1;
+    }
+    memcpy(dev->mem + (size_t)block_no * BDEV_BLOCK_SIZE, buf, BDEV_BLOCK_SIZE);
+    return 0;
+}
+
+static int mmap_sync(blockdev_t *dev) {
+    if (dev->mem && msync(dev->mem, (size_t)dev->nblocks * BDEV_BLOCK_SIZE, MS_SYNC) < 0) {
+        return -1;
+    }
+    return fsync(dev->fd);
+}
+
+static void mmap_close(blockdev_t *dev) {
+    if (dev->mem) {
+        munmap(dev->mem, (size_t)dev->nblocks * BDEV_BLOCK_SIZE);
+    }
+    close_file(dev);
+}
+
+/* -------------------- O_DIRECT -------------------- */
+
+// Callers hand in ordinary (often stack) buffers, so every transfer goes
+// through one block-aligned bounce buffer.
+static int direct_open(blockdev_t *dev, const char *path, int flags) {
+    void *bounce;
+    if (posix_memalign(&bounce, BDEV_BLOCK_SIZE, BDEV_BLOCK_SIZE) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    dev->mem = bounce;
+    return open_file(dev, path, flags, O_DIRECT);
+}
+
+static int direct_read(blockdev_t *dev, uint32_t block_no, void *buf) {
+    if (file_read(dev, block_no, dev->mem) < 0) {
+        return -1;
+    }
+    memcpy(buf, dev->mem, BDEV_BLOCK_SIZE);
+    return 0;
+}
+
+static int direct_write(blockdev_t *dev, uint32_t block_no, const void *buf) {
+    memcpy(dev->mem, buf, BDEV_BLOCK_SIZE);
+    return file_write(dev, block_no, dev->mem);
+}
+
+static void direct_close(blockdev_t *dev) {
+    free(dev->mem);
+    close_file(dev);
+}
+
+/* -------------------- ram -------------------- */
+
+static int ram_open(blockdev_t *dev, const char *path, int flags) {
+    // A created image would be thrown away at close, and its creator would
+    // report success without producing it.
+    if (flags & BDEV_CREATE) {
+        fprintf(stderr, "blockdev: the ram backend cannot create '%s'; its writes are never saved\n", path);
+        errno = EINVAL;
+        return -1;
+    }
+    if (open_file(dev, path, BDEV_RDONLY, 0) < 0) {
+        return -1;
+    }
+    dev->mem = calloc(dev->nblocks ? dev->nblocks : 1, BDEV_BLOCK_SIZE);
+    if (!dev->mem) {
+        return -1;
+    }
+    for (uint32_t b = 0; b < dev->nblocks; ++b) {
+        if (file_read(dev, b, dev->mem + (size_t)b * BDEV_BLOCK_SIZE) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int ram_sync(blockdev_t *dev) {
+    (void)dev;
+    return 0;
+}
+
+static void ram_close(blockdev_t *dev) {
+    free(dev->mem);
+    close_file(dev);
+}
+
+/* -------------------- io_uring -------------------- */
+
+#ifdef BDEV_HAVE_URING
+#define URING_ENTRIES 8U
+
+static int uring_open(blockdev_t *dev, const char *path, int flags) {
+    if (open_file(dev, path, flags, 0) < 0) {
+        return -1;
+    }
+    struct uring *r = &dev->ring;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (r->fd < 0) {
+        return -1;
+    }
+    r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                      IORING_OFF_SQ_RING);
+    r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                      IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+        return -1;
+    }
+    uint8_t *sq = r->sq_ring, *cq = r->cq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+// Submits one request and waits for its completion; returns its result.
+static int uring_submit(blockdev_t *dev, uint8_t opcode, void *buf, uint32_t block_no) {
+    struct uring *r = &dev->ring;
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = dev->fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = buf ? BDEV_BLOCK_SIZE : 0;
+    sqe->off = (uint64_t)block_no * BDEV_BLOCK_SIZE;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (syscall(__NR_io_uring_enter, r->fd, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+        return -1;
+    }
+    unsigned head = __atomic_load_n(r->cq_head, __ATOMIC_ACQUIRE);
+    int res = r->cqes[head & *r->cq_mask].res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return res;
+}
+
+static int uring_read(blockdev_t *dev, uint32_t block_no, void *buf) {
+    int n = uring_submit(dev, IORING_OP_READ, buf, block_no);
+    return n == (int)BDEV_BLOCK_SIZE ? 0 : n < 0 ? -1 : short_io();
+}
+
+static int uring_write(blockdev_t *dev, uint32_t block_no, const void *buf) {
+    int n = uring_submit(dev, IORING_OP_WRITE, (void *)buf, block_no);
+    return n == (int)BDEV_BLOCK_SIZE ? 0 : n < 0 ? -1 : short_io();
+}
+
+static int uring_sync(blockdev_t *dev) {
+    return uring_submit(dev, IORING_OP_FSYNC, NULL, 0) < 0 ? -1 : 0;
+}
+
+static void uring_close(blockdev_t *dev) {
+    struct uring *r = &dev->ring;
+    if (r->sqes && r->sqes != MAP_FAILED) {
+        munmap(r->sqes, r->sqes_len);
+    }
+    if (r->cq_ring && r->cq_ring != MAP_FAILED) {
+        munmap(r->cq_ring, r->cq_ring_len);
+    }
+    if (r->sq_ring && r->sq_ring != MAP_FAILED) {
+        munmap(r->sq_ring, r->sq_ring_len);
+    }
+    if (r->fd > 0) {
+        close(r->fd);
+    }
+    close_file(dev);
+}
+#endif
+
+static const struct bdev_ops backends[] = {
+    {"file", file_open, file_read, file_write, file_sync, close_file},
+    {"mmap", mmap_open, mem_read, mem_write, mmap_sync, mmap_close},
+    {"direct", direct_open, direct_read, direct_write, file_sync, direct_close},
+    {"ram", ram_open, mem_read, mem_write, ram_sync, ram_close},
+#ifdef BDEV_HAVE_URING
+    {"uring", uring_open, uring_read, uring_write, uring_sync, uring_close},
+#endif
+};
+
+/* -------------------- interface -------------------- */
+
+blockdev_t *bdev_open_backend(const char *path, const char *backend, int flags, uint32_t nblocks) {
+    const struct bdev_ops *ops = NULL;
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+        if (strcmp(backends[i].name, backend) == 0) {
+            ops = &backends[i];
+        }
+    }
+    if (!ops) {
+        fprintf(stderr, "blockdev: unknown or unsupported backend '%s'\n", backend);
+        errno = EINVAL;
+        return NULL;
+    }
+    blockdev_t *dev = calloc(1, sizeof(*dev));
+    if (!dev) {
+        return NULL;
+    }
+    dev->ops = ops;
+    dev->fd = -1;
+    dev->iolog_fd = -1;
+    dev->nblocks = nblocks;
+    if (ops->open(dev, path, flags) < 0) {
+        int err = errno;
+        ops->close(dev);
+        free(dev);
+        errno = err;
+        return NULL;
+    }
+    return dev;
+}
+
+blockdev_t *bdev_open(const char *path, int flags, uint32_t nblocks) {
+    const char *backend = getenv("VSFS_BDEV");
+    return bdev_open_backend(path, backend && *backend ? backend : "file", flags, nblocks);
+}
+
+static int iolog_record(blockdev_t *dev, uint32_t op, uint32_t block_no, const void *buf) {
+    if (dev->iolog_fd < 0) {
+        return 0;
+    }
+    // One write per record, so processes sharing the log never interleave.
+    uint8_t rec[sizeof(iolog_rec_t) + BDEV_BLOCK_SIZE];
+    iolog_rec_t ir = {.op = op, .block_no = block_no};
+    size_t len = sizeof(ir);
+    memcpy(rec, &ir, sizeof(ir));
+    if (buf) {
+        memcpy(rec + len, buf, BDEV_BLOCK_SIZE);
+        len += BDEV_BLOCK_SIZE;
+    }
+    return write(dev->iolog_fd, rec, len) == (ssize_t)len ? 0 : -1;
+}
+
+int bdev_read(blockdev_t *dev, uint32_t block_no, void *buf) {
+    return dev->ops->read(dev, block_no, buf);
+}
+
+int bdev_write(blockdev_t *dev, uint32_t block_no, const void *buf) {
+    if (dev->ops->write(dev, block_no, buf) < 0) {
+        return -1;
+    }
+    return iolog_record(dev, IOLOG_WRITE, block_no, buf);
+}
+
+int bdev_sync(blockdev_t *dev) {
+    if (dev->ops->sync(dev) < 0) {
+        return -1;
+    }
+    return iolog_record(dev, IOLOG_BARRIER, 0, NULL);
+}
+
+uint32_t bdev_blocks(const blockdev_t *dev) {
+    return dev->nblocks;
+}
+
+const char *bdev_backend(const blockdev_t *dev) {
+    return dev->ops->name;
+}
+
+int bdev_log_io(blockdev_t *dev, const char *path) {
+    // Whoever creates the log writes its header.
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (fd >= 0) {
+        iolog_header_t ih = {.magic = IOLOG_MAGIC, .version = IOLOG_VERSION};
+        if (write(fd, &ih, sizeof(ih)) != (ssize_t)sizeof(ih)) {
+            close(fd);
+            return -1;
+        }
+    } else if (errno == EEXIST) {
+        fd = open(path, O_WRONLY | O_APPEND);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+    dev->iolog_fd = fd;
+    return 0;
+}
+
+void bdev_close(blockdev_t *dev) {
+    if (!dev) {
+        return;
+    }
+    if (dev->iolog_fd >= 0) {
+        close(dev->iolog_fd);
+    }
+    dev->ops->close(dev);
+    free(dev);
+}
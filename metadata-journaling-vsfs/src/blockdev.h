@@ -0,0 +1,42 @@
+#ifndef VSFS_BLOCKDEV_H
+#define VSFS_BLOCKDEV_H
+
+#include <stdint.h>
+
+// One block-device interface for every tool. The backend is picked with
+// VSFS_BDEV when a device is opened:
+//   file    pread/pwrite on the image (default)
+//   mmap    shared mapping of the image; sync is msync
+//   direct  O_DIRECT through an aligned bounce buffer
+//   uring   io_uring, one request at a time (Linux only)
+//   ram     the image is read into memory at open; writes stay there and are
+//           dropped at close, which takes the I/O cost out of a benchmark.
+//           It refuses BDEV_CREATE, whose image would never be written
+#define BDEV_BLOCK_SIZE 4096U
+
+#define BDEV_RDONLY 0x0
+#define BDEV_RDWR   0x1
+#define BDEV_CREATE 0x2 // create or truncate the image, sized to nblocks blocks
+
+typedef struct blockdev blockdev_t;
+
+// Opens path with the backend named by VSFS_BDEV. nblocks is only used with
+// BDEV_CREATE. Returns NULL with errno set on failure.
+blockdev_t *bdev_open(const char *path, int flags, uint32_t nblocks);
+blockdev_t *bdev_open_backend(const char *path, const char *backend, int flags, uint32_t nblocks);
+
+// Whole-block I/O. Return 0, or -1 with errno set (EIO for a short transfer).
+int bdev_read(blockdev_t *dev, uint32_t block_no, void *buf);
+int bdev_write(blockdev_t *dev, uint32_t block_no, const void *buf);
+int bdev_sync(blockdev_t *dev);
+
+uint32_t bdev_blocks(const blockdev_t *dev);
+const char *bdev_backend(const blockdev_t *dev);
+
+// Appends every later write and sync on dev to the I/O log at path, in issue
+// order (the format crashsim reads). Several processes may share one log.
+int bdev_log_io(blockdev_t *dev, const char *path);
+
+void bdev_close(blockdev_t *dev);
+
+#endif
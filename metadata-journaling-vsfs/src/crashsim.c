@@ -0,0 +1,477 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE        4096U
+#define JOURNAL_BLOCKS      16U
+#define INODE_BLOCKS         2U
+#define DATA_BLOCKS         64U
+#define TOTAL_BLOCKS       (1U + JOURNAL_BLOCKS + 2U + INODE_BLOCKS + DATA_BLOCKS)
+#define IMAGE_BYTES        ((size_t)TOTAL_BLOCKS * BLOCK_SIZE)
+
+// Must match the I/O log written by journal.c under VSFS_IOLOG.
+#define IOLOG_MAGIC   0x4f495356U // "VSIO"
+#define IOLOG_VERSION 1U
+#define IOLOG_WRITE   1U
+#define IOLOG_BARRIER 2U
+
+#define TEAR_BYTES (BLOCK_SIZE / 2) // a torn write lands on a sector boundary
+#define MAX_VERSIONS 8U // distinct contents one block may take within an epoch
+#define DEFAULT_MAX_STATES 10000U
+
+struct iolog_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct iolog_rec {
+    uint32_t op;
+    uint32_t block_no;
+};
+
+// A block written between two barriers. After a crash it may hold its
+// content from the start of the epoch, any version written during it, or
+// (with --torn) a version torn at half a block: new first sectors, old rest.
+struct block_choice {
+    uint32_t block;
+    uint32_t nver;
+    const uint8_t *ver[MAX_VERSIONS];
+};
+
+// Writes between two barriers; the device may persist any subset of them in
+// any order, but everything before the opening barrier is on disk.
+struct epoch {
+    uint32_t index;
+    uint8_t *start; // image at the opening barrier
+    uint32_t nblocks;
+    struct block_choice blocks[TOTAL_BLOCKS];
+    uint64_t space;  // size of the full state space
+    uint64_t states; // states actually run: space, or max_states if sampled
+};
+
+struct sim {
+    const char *bin;
+    int torn;
+    int keep;
+    uint64_t max_states;
+    struct epoch *epochs;
+    uint32_t nepochs;
+};
+
+static void die(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static uint32_t choices_per_block(const struct sim *sim, const struct block_choice *bc) {
+    return 1 + bc->nver * (sim->torn ? 2U : 1U);
+}
+
+/* -------------------- loading -------------------- */
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        die(path);
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    uint8_t *buf = malloc(size > 0 ? (size_t)size : 1);
+    if (!buf) {
+        die("malloc");
+    }
+    if (size > 0 && pread(fd, buf, (size_t)size, 0) != size) {
+        die("pread");
+    }
+    close(fd);
+    *len = (size_t)size;
+    return buf;
+}
+
+static void add_write(struct epoch *ep, uint32_t block, const uint8_t *data) {
+    // A write that leaves the block as it was cannot change what a crash leaves behind.
+    if (memcmp(ep->start + (size_t)block * BLOCK_SIZE, data, BLOCK_SIZE) == 0) {
+        return;
+    }
+    struct block_choice *bc = NULL;
+    for (uint32_t i = 0; i < ep->nblocks; ++i) {
+        if (ep->blocks[i].block == block) {
+            bc = &ep->blocks[i];
+            break;
+        }
+    }
+    if (!bc) {
+        bc = &ep->blocks[ep->nblocks++];
+        bc->block = block;
+        bc->nver = 0;
+    }
+    for (uint32_t v = 0; v < bc->nver; ++v) {
+        if (memcmp(bc->ver[v], data, BLOCK_SIZE) == 0) {
+            return;
+        }
+    }
+    if (bc->nver == MAX_VERSIONS) {
+        fprintf(stderr, "crashsim: block %u written more than %u ways in epoch %u\n", block, MAX_VERSIONS,
+                ep->index);
+        exit(EXIT_FAILURE);
+    }
+    bc->ver[bc->nver++] = data;
+}
+
+// Splits the log at its barriers. The image at each epoch start is the base
+// image with every earlier write applied in issue order.
+static void load_epochs(struct sim *sim, const uint8_t *base, const uint8_t *log, size_t log_len) {
+    struct iolog_header ih;
+    if (log_len < sizeof(ih) || (memcpy(&ih, log, sizeof(ih)), ih.magic != IOLOG_MAGIC) ||
+        ih.version != IOLOG_VERSION) {
+        fprintf(stderr, "crashsim: not an I/O log\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t *cur = malloc(IMAGE_BYTES);
+    if (!cur) {
+        die("malloc");
+    }
+    memcpy(cur, base, IMAGE_BYTES);
+
+    uint32_t cap = 16;
+    sim->epochs = calloc(cap, sizeof(struct epoch));
+    if (!sim->epochs) {
+        die("calloc");
+    }
+    struct epoch *ep = NULL;
+    size_t off = sizeof(ih);
+    for (;;) {
+        if (!ep) {
+            if (sim->nepochs == cap) {
+                cap *= 2;
+                sim->epochs = realloc(sim->epochs, cap * sizeof(struct epoch));
+                if (!sim->epochs) {
+                    die("realloc");
+                }
+            }
+            ep = &sim->epochs[sim->nepochs];
+            memset(ep, 0, sizeof(*ep));
+            ep->index = sim->nepochs;
+            ep->start = malloc(IMAGE_BYTES);
+            if (!ep->start) {
+                die("malloc");
+            }
+            memcpy(ep->start, cur, IMAGE_BYTES);
+        }
+        if (off + sizeof(struct iolog_rec) > log_len) {
+            break;
+        }
+        struct iolog_rec ir;
+        memcpy(&ir, log + off, sizeof(ir));
+        off += sizeof(ir);
+        if (ir.op == IOLOG_WRITE) {
+            if (off + BLOCK_SIZE > log_len || ir.block_no >= TOTAL_BLOCKS) {
+                fprintf(stderr, "crashsim: truncated or corrupt I/O log\n");
+                exit(EXIT_FAILURE);
+            }
+            add_write(ep, ir.block_no, log + off);
+            memcpy(cur + (size_t)ir.block_no * BLOCK_SIZE, log + off, BLOCK_SIZE);
+            off += BLOCK_SIZE;
+        } else if (ir.op == IOLOG_BARRIER) {
+            // Back-to-back barriers add no new states.
+            if (ep->nblocks > 0) {
+                sim->nepochs++;
+            } else {
+                free(ep->start);
+            }
+            ep = NULL;
+        } else {
+            fprintf(stderr, "crashsim: unknown I/O log record %u\n", ir.op);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // The last epoch is kept even if empty: it is the fully synced final state.
+    sim->nepochs++;
+    free(cur);
+
+    for (uint32_t e = 0; e < sim->nepochs; ++e) {
+        struct epoch *p = &sim->epochs[e];
+        p->space = 1;
+        for (uint32_t b = 0; b < p->nblocks; ++b) {
+            p->space *= choices_per_block(sim, &p->blocks[b]);
+            if (p->space > UINT32_MAX) {
+                p->space = UINT32_MAX; // far past any usable --max-states
+            }
+        }
+        p->states = p->space > sim->max_states ? sim->max_states : p->space;
+    }
+}
+
+/* -------------------- one crash state -------------------- */
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Decodes state k of an epoch into one choice per block and builds the
+// resulting image. An exhaustive epoch enumerates k as a mixed-radix number;
+// a sampled one draws each digit from a hash of (epoch, k).
+static void build_state(const struct sim *sim, const struct epoch *ep, uint64_t k, uint8_t *img,
+                        uint32_t *choice) {
+    memcpy(img, ep->start, IMAGE_BYTES);
+    uint64_t rest = k;
+    for (uint32_t b = 0; b < ep->nblocks; ++b) {
+        const struct block_choice *bc = &ep->blocks[b];
+        uint32_t radix = choices_per_block(sim, bc);
+        if (ep->states < ep->space) {
+            choice[b] = (uint32_t)(mix64(((uint64_t)ep->index << 40) ^ (k << 8) ^ b) % radix);
+        } else {
+            choice[b] = (uint32_t)(rest % radix);
+            rest /= radix;
+        }
+        uint8_t *dst = img + (size_t)bc->block * BLOCK_SIZE;
+        if (choice[b] == 0) {
+            continue;
+        } else if (choice[b] <= bc->nver) {
+            memcpy(dst, bc->ver[choice[b] - 1], BLOCK_SIZE);
+        } else {
+            memcpy(dst, bc->ver[choice[b] - 1 - bc->nver], TEAR_BYTES);
+        }
+    }
+}
+
+static void describe_state(const struct epoch *ep, const uint32_t *choice, FILE *out) {
+    fprintf(out, "epoch %u:", ep->index);
+    if (ep->nblocks == 0) {
+        fprintf(out, " (final synced state)");
+    }
+    for (uint32_t b = 0; b < ep->nblocks; ++b) {
+        const struct block_choice *bc = &ep->blocks[b];
+        fprintf(out, " %u=", bc->block);
+        if (choice[b] == 0) {
+            fprintf(out, "old");
+        } else if (choice[b] <= bc->nver) {
+            fprintf(out, "v%u", choice[b]);
+        } else {
+            fprintf(out, "torn-v%u", choice[b] - bc->nver);
+        }
+    }
+}
+
+// Runs a tool on the image with its output discarded; returns its exit status.
+static int run_tool(const char *bin, const char *tool, char *const args[]) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", bin, tool);
+    pid_t pid = fork();
+    if (pid < 0) {
+        die("fork");
+    }
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+        }
+        execv(path, args);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        die("waitpid");
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// The journal's control block lives next to the image and, like memory,
+// does not survive a crash.
+static void unlink_ctl(const char *path) {
+    char ctl[4096 + 8];
+    snprintf(ctl, sizeof(ctl), "%s.ctl", path);
+    unlink(ctl);
+}
+
+// Recovery is the install every tool expects after a crash; the recovered
+// image must then pass the validator.
+static const char *check_state(const struct sim *sim, const char *path, const uint8_t *img) {
+    unlink_ctl(path);
+    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        die("open state image");
+    }
+    if (pwrite(fd, img, IMAGE_BYTES, 0) != (ssize_t)IMAGE_BYTES) {
+        die("pwrite state image");
+    }
+    close(fd);
+
+    char *install[] = {"journal", "-f", (char *)path, "install", NULL};
+    if (run_tool(sim->bin, "journal", install) != 0) {
+        return "recovery failed";
+    }
+    char *validate[] = {"validator", (char *)path, NULL};
+    if (run_tool(sim->bin, "validator", validate) != 0) {
+        return "recovered image is inconsistent";
+    }
+    return NULL;
+}
+
+/* -------------------- workers -------------------- */
+
+// Worker w of n checks every n-th state across all epochs and reports how
+// many failed through its pipe.
+static void worker(const struct sim *sim, uint32_t w, uint32_t n, int report) {
+    char path[4096];
+    const char *tmp = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/crashsim.%d.img", tmp && *tmp ? tmp : "/tmp", (int)getpid());
+
+    uint8_t *img = malloc(IMAGE_BYTES);
+    if (!img) {
+        die("malloc");
+    }
+    uint32_t choice[TOTAL_BLOCKS];
+    uint64_t global = 0;
+    uint32_t failures = 0;
+    for (uint32_t e = 0; e < sim->nepochs; ++e) {
+        const struct epoch *ep = &sim->epochs[e];
+        for (uint64_t k = 0; k < ep->states; ++k, ++global) {
+            if (global % n != w) {
+                continue;
+            }
+            build_state(sim, ep, k, img, choice);
+            const char *why = check_state(sim, path, img);
+            if (!why) {
+                continue;
+            }
+            failures++;
+            char line[8192];
+            FILE *mem = fmemopen(line, sizeof(line), "w");
+            if (!mem) {
+                die("fmemopen");
+            }
+            fprintf(mem, "FAIL %s: ", why);
+            describe_state(ep, choice, mem);
+            if (sim->keep) {
+                char keep[64];
+                snprintf(keep, sizeof(keep), "crash-%u-%llu.img", e, (unsigned long long)k);
+                build_state(sim, ep, k, img, choice);
+                int kfd = open(keep, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+                if (kfd >= 0 && pwrite(kfd, img, IMAGE_BYTES, 0) == (ssize_t)IMAGE_BYTES) {
+                    fprintf(mem, " (saved as %s)", keep);
+                }
+                if (kfd >= 0) {
+                    close(kfd);
+                }
+            }
+            fputc('\0', mem);
+            fclose(mem);
+            printf("%s\n", line);
+            fflush(stdout);
+        }
+    }
+    unlink(path);
+    unlink_ctl(path);
+    free(img);
+    if (write(report, &failures, sizeof(failures)) != (ssize_t)sizeof(failures)) {
+        die("write report");
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-j jobs] [--torn] [--max-states n] [--bin dir] [--keep] <base-image> <iolog>\n"
+            "  Replays an I/O log recorded with VSFS_IOLOG=<iolog> on top of <base-image> and\n"
+            "  checks every state a crash could leave: recovery (journal install) must succeed\n"
+            "  and the validator must accept the result.\n"
+            "  --torn        also tear each written block at half a block\n"
+            "  --max-states  sample epochs with more states than this (default %u)\n"
+            "  --bin         directory holding journal and validator (default .)\n"
+            "  --keep        save failing crash images as crash-<epoch>-<state>.img\n",
+            prog, DEFAULT_MAX_STATES);
+}
+
+int main(int argc, char *argv[]) {
+    struct sim sim = {.bin = ".", .max_states = DEFAULT_MAX_STATES};
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *paths[2];
+    int npaths = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--torn") == 0) {
+            sim.torn = 1;
+        } else if (strcmp(argv[i], "--max-states") == 0 && i + 1 < argc) {
+            sim.max_states = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--bin") == 0 && i + 1 < argc) {
+            sim.bin = argv[++i];
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            sim.keep = 1;
+        } else if (argv[i][0] != '-' && npaths < 2) {
+            paths[npaths++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (npaths != 2 || jobs < 1 || sim.max_states < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    size_t base_len, log_len;
+    uint8_t *base = read_file(paths[0], &base_len);
+    if (base_len != IMAGE_BYTES) {
+        fprintf(stderr, "crashsim: '%s' is not a %u-block image\n", paths[0], TOTAL_BLOCKS);
+        return 2;
+    }
+    uint8_t *log = read_file(paths[1], &log_len);
+    load_epochs(&sim, base, log, log_len);
+
+    uint64_t total = 0;
+    uint32_t sampled = 0;
+    for (uint32_t e = 0; e < sim.nepochs; ++e) {
+        total += sim.epochs[e].states;
+        sampled += sim.epochs[e].states < sim.epochs[e].space;
+    }
+    printf("crashsim: %u epoch(s), %llu crash state(s)%s, %ld job(s)\n", sim.nepochs, (unsigned long long)total,
+           sim.torn ? " including torn writes" : "", jobs);
+    if (sampled) {
+        printf("crashsim: %u epoch(s) exceed --max-states and are sampled\n", sampled);
+    }
+    fflush(stdout);
+
+    int pipes[2];
+    if (pipe(pipes) < 0) {
+        die("pipe");
+    }
+    for (long w = 0; w < jobs; ++w) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            die("fork");
+        }
+        if (pid == 0) {
+            close(pipes[0]);
+            worker(&sim, (uint32_t)w, (uint32_t)jobs, pipes[1]);
+            _exit(0);
+        }
+    }
+    close(pipes[1]);
+
+    uint32_t failures = 0, reports = 0, f;
+    while (read(pipes[0], &f, sizeof(f)) == (ssize_t)sizeof(f)) {
+        failures += f;
+        reports++;
+    }
+    while (wait(NULL) > 0) {
+    }
+    if (reports != (uint32_t)jobs) {
+        fprintf(stderr, "crashsim: %ld worker(s) died\n", jobs - (long)reports);
+        return 2;
+    }
+
+    printf("crashsim: %llu state(s) checked, %u failure(s)\n", (unsigned long long)total, failures);
+    return failures ? 1 : 0;
+}
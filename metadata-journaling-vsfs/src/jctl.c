@@ -0,0 +1,479 @@
+#include "jctl.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#define JCTL_HAVE_FUTEX 1
+#endif
+
+#define JCTL_MAGIC   0x4c544356U // "VCTL"
+#define JCTL_VERSION 3U
+#define SLOTS        64U          // tickets in flight at once
+#define SLOT_EXCL    0x80000000U  // slot flag: exclusive ticket
+#define POLL_MS      10           // waiters look for dead holders this often
+#define UNREGISTERED_GRACE_MS 1000 // a ticket taken but never registered
+#define CACHE_SPIN   64           // seqlock read attempts before yielding
+#define CACHE_TRIES  1024         // before giving up and reading uncached
+
+// Layout of "<image>.ctl". Turns and the tail only move forward while held.
+// Every field is accessed with atomics except the cache slots and
+// cache_next, which are plain memory guarded by the cache_seq seqlock.
+struct jctl_shm {
+    uint32_t magic;
+    uint32_t version;
+    char boot_id[40];       // a control block from before a reboot is reset
+    uint32_t next_ticket;   // tickets handed out, in commit order
+    uint32_t build_turn;    // ticket that may read metadata and write records
+    uint32_t publish_turn;  // ticket that may advance the on-disk header
+    uint32_t tail;          // end of reserved journal space
+    uint32_t build_start;   // tail when the current build turn began
+    uint32_t published;     // header nbytes last made durable
+    uint32_t resync_ticket; // this ticket reloads the tail from disk...
+    uint32_t resync_pending; // ...if set
+    uint32_t gen;           // moves whenever the journal restarts
+    uint64_t rewritten;     // position of the last change to unstamped items
+    uint64_t slot[SLOTS];   // (ticket << 32) | flags | pid, for ticket % SLOTS
+    uint64_t ver[JCTL_ITEMS];   // position of the last build that wrote the item
+    uint32_t claim[JCTL_ITEMS]; // ticket + 1 of a planned, unbuilt writer
+
+    // The image file as of the last coordinated write, to notice writes by
+    // other tools while nobody is in flight.
+    uint64_t image_ino;
+    int64_t image_size;
+    int64_t image_mtime_ns;
+
+    // Newest published metadata blocks, behind one seqlock (odd while the
+    // publish holder rewrites them) so a reader always sees a single commit.
+    uint32_t cache_seq;
+    uint32_t cache_next;    // slot to evict next
+    uint64_t cache_pos;     // position of the publish the cache reflects
+    struct {
+        uint32_t block_no;
+        uint32_t used;
+        unsigned char data[JCTL_BLOCK_SIZE];
+    } cache[JCTL_CACHE_BLOCKS];
+};
+
+struct jctl {
+    int fd;
+    char image_path[4096];
+    struct jctl_shm *shm;
+    uint32_t unreg_ticket; // holder seen unregistered, and since when
+    uint64_t unreg_since;
+};
+
+static uint32_t load(const uint32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store(uint32_t *p, uint32_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static uint64_t position(uint32_t gen, uint32_t off) {
+    return (uint64_t)gen << 32 | off;
+}
+
+// Tickets wrap; a precedes b if the signed distance is negative.
+static int before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+#ifdef JCTL_HAVE_FUTEX
+// Shared (not private) futexes: the waiters are in other processes.
+static void futex_wait(uint32_t *addr, uint32_t val, int ms) {
+    struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+#else
+#define FUTEX_NAP_NS 200000L // without futexes, waiters poll this often
+
+// Polls the word until it changes or ms pass; there is no one to wake.
+static void futex_wait(uint32_t *addr, uint32_t val, int ms) {
+    struct timespec nap = {0, FUTEX_NAP_NS};
+    uint64_t until = now_ms() + (uint64_t)ms;
+    while (__atomic_load_n(addr, __ATOMIC_ACQUIRE) == val && now_ms() < until) {
+        nanosleep(&nap, NULL);
+    }
+}
+
+static void futex_wake(uint32_t *addr) {
+    (void)addr;
+}
+#endif
+
+static void read_boot_id(char *out, size_t len) {
+    memset(out, 0, len);
+    int fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+    if (fd < 0) return;
+    ssize_t n = read(fd, out, len - 1);
+    close(fd);
+    if (n > 0) out[strcspn(out, "\n")] = '\0';
+}
+
+static int image_identity(const char *image_path, uint64_t *ino, int64_t *size, int64_t *mtime_ns) {
+    struct stat st;
+    if (stat(image_path, &st) != 0) return -1;
+    *ino = (uint64_t)st.st_ino;
+    *size = (int64_t)st.st_size;
+    *mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+// Called after each coordinated write by the holder of the last turn.
+static void record_image(jctl_t *c) {
+    uint64_t ino;
+    int64_t size, mtime_ns;
+    if (image_identity(c->image_path, &ino, &size, &mtime_ns) != 0) return;
+    __atomic_store_n(&c->shm->image_ino, ino, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->shm->image_size, size, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->shm->image_mtime_ns, mtime_ns, __ATOMIC_RELEASE);
+}
+
+static int image_unchanged(const struct jctl_shm *shm, const char *image_path) {
+    uint64_t ino;
+    int64_t size, mtime_ns;
+    return image_identity(image_path, &ino, &size, &mtime_ns) == 0 && ino == shm->image_ino &&
+           size == shm->image_size && mtime_ns == shm->image_mtime_ns;
+}
+
+jctl_t *jctl_open(const char *image_path) {
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s.ctl", image_path) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return NULL;
+
+    // The lock only covers setup and dead-holder recovery, never a commit.
+    struct stat st;
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0 ||
+        (st.st_size < (off_t)sizeof(struct jctl_shm) && ftruncate(fd, sizeof(struct jctl_shm)) != 0)) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+    struct jctl_shm *shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+
+    char boot_id[sizeof(shm->boot_id)];
+    read_boot_id(boot_id, sizeof(boot_id));
+    if (shm->magic != JCTL_MAGIC || shm->version != JCTL_VERSION || strcmp(shm->boot_id, boot_id) != 0) {
+        memset(shm, 0, sizeof(*shm));
+        memcpy(shm->boot_id, boot_id, sizeof(boot_id));
+        shm->version = JCTL_VERSION;
+        store(&shm->magic, JCTL_MAGIC);
+    }
+    // With nobody in flight, another tool (mkfs, age, metaimg) may have
+    // written the image since the last coordinated write; if so the next
+    // ticket rereads the tail from disk and everything derived is dropped.
+    uint32_t n = load(&shm->next_ticket);
+    if (load(&shm->publish_turn) == n && !image_unchanged(shm, image_path)) {
+        store(&shm->resync_ticket, n);
+        store(&shm->resync_pending, 1);
+        __atomic_store_n(&shm->rewritten, position(load(&shm->gen), UINT32_MAX), __ATOMIC_RELEASE);
+    }
+    flock(fd, LOCK_UN);
+
+    jctl_t *c = calloc(1, sizeof(*c));
+    if (!c) {
+        munmap(shm, sizeof(*shm));
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    c->fd = fd;
+    c->shm = shm;
+    snprintf(c->image_path, sizeof(c->image_path), "%s", image_path);
+    return c;
+}
+
+void jctl_close(jctl_t *c) {
+    if (!c) return;
+    munmap(c->shm, sizeof(*c->shm));
+    close(c->fd);
+    free(c);
+}
+
+static int holder_dead(jctl_t *c, uint32_t t) {
+    uint64_t s = __atomic_load_n(&c->shm->slot[t % SLOTS], __ATOMIC_ACQUIRE);
+    pid_t pid = (pid_t)(s & ~(uint64_t)SLOT_EXCL & 0xffffffffU);
+    if ((uint32_t)(s >> 32) != t || pid == 0) {
+        // Between taking a ticket and registering it; only a crash in that
+        // window leaves it unregistered for long.
+        if (c->unreg_ticket != t || c->unreg_since == 0) {
+            c->unreg_ticket = t;
+            c->unreg_since = now_ms();
+            return 0;
+        }
+        return now_ms() - c->unreg_since > UNREGISTERED_GRACE_MS;
+    }
+    return kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+static int slot_exclusive(const jctl_t *c, uint32_t t) {
+    return (__atomic_load_n(&c->shm->slot[t % SLOTS], __ATOMIC_ACQUIRE) & SLOT_EXCL) != 0;
+}
+
+// Empties the cache after its publisher died, possibly mid-publish with the
+// seqlock left odd. Only the publish holder writes the cache, and it is dead.
+static void cache_reset(struct jctl_shm *shm) {
+    uint32_t seq = __atomic_load_n(&shm->cache_seq, __ATOMIC_RELAXED);
+    if (!(seq & 1U)) __atomic_store_n(&shm->cache_seq, ++seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (uint32_t s = 0; s < JCTL_CACHE_BLOCKS; s++) shm->cache[s].used = 0;
+    __atomic_store_n(&shm->cache_seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// Takes over turns whose holders have died.
+static void reap(jctl_t *c) {
+    struct jctl_shm *shm = c->shm;
+    if (flock(c->fd, LOCK_EX) != 0) return;
+    uint32_t b = load(&shm->build_turn), p = load(&shm->publish_turn);
+    if (b != load(&shm->next_ticket) && holder_dead(c, b)) {
+        if (!slot_exclusive(c, b)) {
+            // Its records may be partial: give its space to the next builder.
+            store(&shm->tail, load(&shm->build_start));
+            store(&shm->build_turn, b + 1);
+            futex_wake(&shm->build_turn);
+            fprintf(stderr, "journal: took over the build turn of dead ticket %u\n", b);
+        } else if (p == b) {
+            // It may have been anywhere in an install; trust only the disk.
+            store(&shm->resync_ticket, b + 1);
+            store(&shm->resync_pending, 1);
+            cache_reset(shm);
+            store(&shm->publish_turn, b + 1);
+            store(&shm->build_turn, b + 1);
+            futex_wake(&shm->publish_turn);
+            futex_wake(&shm->build_turn);
+            fprintf(stderr, "journal: took over the turns of dead exclusive ticket %u\n", b);
+        }
+    }
+    b = load(&shm->build_turn);
+    p = load(&shm->publish_turn);
+    if (before(p, b) && !slot_exclusive(c, p) && holder_dead(c, p)) {
+        // Its records are complete (or rolled back); a later publish covers them.
+        cache_reset(shm);
+        store(&shm->publish_turn, p + 1);
+        futex_wake(&shm->publish_turn);
+    }
+    flock(c->fd, LOCK_UN);
+}
+
+static void wait_turn(jctl_t *c, uint32_t *turn, uint32_t t) {
+    for (;;) {
+        uint32_t cur = load(turn);
+        if (cur == t) return;
+        futex_wait(turn, cur, POLL_MS);
+        if (load(turn) == cur) reap(c);
+    }
+}
+
+uint32_t jctl_ticket(jctl_t *c, int exclusive) {
+    struct jctl_shm *shm = c->shm;
+    uint32_t t = __atomic_fetch_add(&shm->next_ticket, 1, __ATOMIC_ACQ_REL);
+    // The slot is reused once the ticket SLOTS before this one has published.
+    for (;;) {
+        uint32_t p = load(&shm->publish_turn);
+        if (t - p < SLOTS) break;
+        futex_wait(&shm->publish_turn, p, POLL_MS);
+        if (load(&shm->publish_turn) == p) reap(c);
+    }
+    uint64_t s = ((uint64_t)t << 32) | (exclusive ? SLOT_EXCL : 0) | (uint32_t)getpid();
+    __atomic_store_n(&shm->slot[t % SLOTS], s, __ATOMIC_RELEASE);
+    return t;
+}
+
+uint32_t jctl_waiting(const jctl_t *c) {
+    return load(&c->shm->next_ticket) - load(&c->shm->build_turn);
+}
+
+void jctl_wait_build(jctl_t *c, uint32_t t) {
+    wait_turn(c, &c->shm->build_turn, t);
+}
+
+uint32_t jctl_begin(jctl_t *c, int exclusive) {
+    uint32_t t = jctl_ticket(c, exclusive);
+    wait_turn(c, &c->shm->build_turn, t);
+    if (exclusive) wait_turn(c, &c->shm->publish_turn, t);
+    return t;
+}
+
+int jctl_stale(const jctl_t *c, uint32_t t) {
+    return load(&c->shm->resync_pending) && load(&c->shm->resync_ticket) == t;
+}
+
+// Restarts the tail in a new generation; returns the generation.
+static uint32_t restart(jctl_t *c, uint32_t nbytes) {
+    store(&c->shm->tail, nbytes);
+    store(&c->shm->build_start, nbytes);
+    store(&c->shm->published, nbytes);
+    return __atomic_add_fetch(&c->shm->gen, 1, __ATOMIC_ACQ_REL);
+}
+
+void jctl_invalidate(jctl_t *c) {
+    __atomic_store_n(&c->shm->rewritten, position(load(&c->shm->gen), UINT32_MAX), __ATOMIC_RELEASE);
+}
+
+void jctl_resync(jctl_t *c, uint32_t nbytes) {
+    // Whatever made the tail stale may have changed any item.
+    jctl_invalidate(c);
+    restart(c, nbytes);
+    store(&c->shm->resync_pending, 0);
+}
+
+uint64_t jctl_snapshot(const jctl_t *c) {
+    uint32_t g, end;
+    do {
+        g = load(&c->shm->gen);
+        end = load(&c->shm->build_start);
+    } while (load(&c->shm->gen) != g);
+    return position(g, end);
+}
+
+int jctl_current(const jctl_t *c, uint64_t pos) {
+    return (uint32_t)(pos >> 32) == load(&c->shm->gen);
+}
+
+uint64_t jctl_version(const jctl_t *c, uint32_t item) {
+    uint64_t v = __atomic_load_n(&c->shm->ver[item % JCTL_ITEMS], __ATOMIC_ACQUIRE);
+    uint64_t r = __atomic_load_n(&c->shm->rewritten, __ATOMIC_ACQUIRE);
+    return v > r ? v : r;
+}
+
+int jctl_claim(jctl_t *c, uint32_t item, uint32_t t) {
+    uint32_t *claim = &c->shm->claim[item % JCTL_ITEMS];
+    uint32_t cur = load(claim);
+    for (;;) {
+        if (cur == t + 1) return 1;
+        // A claim lapses once its ticket has had its build turn.
+        if (cur != 0 && !before(cur - 1, load(&c->shm->build_turn))) return 0;
+        if (__atomic_compare_exchange_n(claim, &cur, t + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return 1;
+    }
+}
+
+void jctl_bump(jctl_t *c, uint32_t item) {
+    uint64_t pos = position(load(&c->shm->gen), load(&c->shm->tail));
+    __atomic_store_n(&c->shm->ver[item % JCTL_ITEMS], pos, __ATOMIC_RELEASE);
+    store(&c->shm->claim[item % JCTL_ITEMS], 0);
+}
+
+uint32_t jctl_tail(const jctl_t *c) {
+    return load(&c->shm->tail);
+}
+
+int jctl_reserve(jctl_t *c, uint32_t len, uint32_t limit, uint32_t *off) {
+    uint32_t cur = load(&c->shm->tail);
+    do {
+        if (cur > limit || len > limit - cur) return -1;
+    } while (!__atomic_compare_exchange_n(&c->shm->tail, &cur, cur + len, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    *off = cur;
+    return 0;
+}
+
+void jctl_built(jctl_t *c, uint32_t t) {
+    store(&c->shm->build_start, load(&c->shm->tail));
+    store(&c->shm->build_turn, t + 1);
+    futex_wake(&c->shm->build_turn);
+}
+
+void jctl_wait_publish(jctl_t *c, uint32_t t) {
+    wait_turn(c, &c->shm->publish_turn, t);
+}
+
+void jctl_published(jctl_t *c, uint32_t t, uint32_t nbytes) {
+    if (nbytes > load(&c->shm->published)) store(&c->shm->published, nbytes);
+    record_image(c);
+    store(&c->shm->publish_turn, t + 1);
+    futex_wake(&c->shm->publish_turn);
+}
+
+void jctl_end(jctl_t *c, uint32_t t, uint32_t nbytes, int rewrote) {
+    if (rewrote) {
+        jctl_resync(c, nbytes);
+    } else {
+        restart(c, nbytes);
+    }
+    record_image(c);
+    store(&c->shm->publish_turn, t + 1);
+    store(&c->shm->build_turn, t + 1);
+    futex_wake(&c->shm->publish_turn);
+    futex_wake(&c->shm->build_turn);
+}
+
+void jctl_cache_publish(jctl_t *c, uint32_t n, const uint32_t *block_no, const unsigned char *const *data) {
+    struct jctl_shm *shm = c->shm;
+    uint32_t seq = __atomic_load_n(&shm->cache_seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm->cache_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t s = 0;
+        while (s < JCTL_CACHE_BLOCKS && !(shm->cache[s].used && shm->cache[s].block_no == block_no[i])) s++;
+        if (s == JCTL_CACHE_BLOCKS) {
+            s = shm->cache_next;
+            shm->cache_next = (s + 1) % JCTL_CACHE_BLOCKS;
+        }
+        shm->cache[s].block_no = block_no[i];
+        shm->cache[s].used = 1;
+        memcpy(shm->cache[s].data, data[i], JCTL_BLOCK_SIZE);
+    }
+    shm->cache_pos = position(load(&shm->gen), load(&shm->published));
+    __atomic_store_n(&shm->cache_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int jctl_cache_read(const jctl_t *c, uint32_t n, const uint32_t *block_no, unsigned char *const *data) {
+    const struct jctl_shm *shm = c->shm;
+    for (unsigned attempt = 1; attempt <= CACHE_TRIES; attempt++) {
+        uint32_t seq = __atomic_load_n(&shm->cache_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1U) {
+            if (attempt % CACHE_SPIN == 0) sched_yield();
+            continue;
+        }
+        int hit = shm->cache_pos > __atomic_load_n(&shm->rewritten, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; hit && i < n; i++) {
+            uint32_t s = 0;
+            while (s < JCTL_CACHE_BLOCKS && !(shm->cache[s].used && shm->cache[s].block_no == block_no[i])) s++;
+            if (s == JCTL_CACHE_BLOCKS) {
+                hit = 0;
+            } else {
+                memcpy(data[i], shm->cache[s].data, JCTL_BLOCK_SIZE);
+            }
+        }
+        // The copies may be torn; they count only if no publish overlapped.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->cache_seq, __ATOMIC_RELAXED) == seq) return hit;
+        if (attempt % CACHE_SPIN == 0) sched_yield();
+    }
+    // Busy publishers or a dead one not yet reaped; the caller reads disk.
+    return 0;
+}
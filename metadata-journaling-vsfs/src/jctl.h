@@ -0,0 +1,115 @@
+#ifndef VSFS_JCTL_H
+#define VSFS_JCTL_H
+
+#include <stdint.h>
+
+// Journal control block: a small file next to the image ("<image>.ctl"),
+// mapped shared by every journal process working on that image, so several
+// processes can journal into one image without a global lock.
+//
+// Each transaction takes a ticket; tickets fix the commit order. A
+// transaction then goes through two turns, both granted in ticket order:
+//   build    read metadata, reserve journal space by advancing the shared
+//            tail, and write the records (no sync yet)
+//   publish  advance the on-disk journal header over the records
+// Between the two, the records are synced while later tickets build, so the
+// slow part of a commit overlaps across processes. Install-like commands
+// take an exclusive ticket that holds both turns at once.
+//
+// A process that dies holding a turn is detected by the waiters and its turn
+// is taken over: a dead builder's reservation is rolled back, a dead
+// publisher is skipped (a later publish covers its complete records), and
+// after a dead exclusive holder the next ticket resyncs the tail from disk.
+//
+// A transaction may also plan optimistically between taking its ticket and
+// its build turn: it reads the journal up to the end of the last completed
+// build (its snapshot) and claims the items it means to write, so concurrent
+// planners pick others. Versions are journal positions, (generation << 32)
+// | offset: a build stamps each item it writes with the tail it reserved up
+// to. An exclusive ticket restarts the journal in a new generation; one that
+// changed metadata without stamping it (apply, or a resync after a crash)
+// stamps every item at once. In its build turn the planner checks that every
+// item it read is no newer than its snapshot; otherwise it plans again,
+// holding the turn.
+typedef struct jctl jctl_t;
+
+#define JCTL_ITEMS 256U // versioned items, numbered by the caller
+//
+// Readers that want the newest published metadata without a turn read it
+// from a small cache of blocks in the control block, rewritten by each
+// publish holder under a seqlock: readers never wait for a commit and retry
+// only if a publish overlapped their copy.
+#define JCTL_CACHE_BLOCKS 8U
+#define JCTL_BLOCK_SIZE   4096U
+
+// Maps "<image_path>.ctl", creating it if needed. NULL with errno on failure.
+jctl_t *jctl_open(const char *image_path);
+void jctl_close(jctl_t *c);
+
+// Takes a ticket and waits for its build turn; an exclusive ticket also
+// waits until every earlier ticket has published.
+uint32_t jctl_begin(jctl_t *c, int exclusive);
+
+// The two halves of jctl_begin for a non-exclusive ticket, with planning
+// in between.
+uint32_t jctl_ticket(jctl_t *c, int exclusive);
+void jctl_wait_build(jctl_t *c, uint32_t t);
+
+// Tickets handed out that have not built yet: each may still reserve journal
+// space ahead of a ticket taken now.
+uint32_t jctl_waiting(const jctl_t *c);
+
+// True if the holder of ticket t must reload the tail from the on-disk
+// journal header (fresh control block, or a crashed exclusive holder).
+int jctl_stale(const jctl_t *c, uint32_t t);
+void jctl_resync(jctl_t *c, uint32_t nbytes);
+
+// End of the reserved journal space; everything below it is written.
+uint32_t jctl_tail(const jctl_t *c);
+
+// Position of the end of the last completed build (everything below it is
+// written, though maybe not published); usable without a turn.
+uint64_t jctl_snapshot(const jctl_t *c);
+int jctl_current(const jctl_t *c, uint64_t pos); // pos is in this generation
+
+// Position of the last change to item.
+uint64_t jctl_version(const jctl_t *c, uint32_t item);
+
+// Claims item for ticket t unless a ticket that has not built yet holds it.
+// Returns 1 if t holds the claim. Claims lapse when their ticket builds.
+int jctl_claim(jctl_t *c, uint32_t item, uint32_t t);
+
+// Stamps item as written by the build turn's holder, whose reservation
+// must already be made, and drops its claim.
+void jctl_bump(jctl_t *c, uint32_t item);
+
+// Reserves len bytes at the tail, keeping it at or below limit. Returns 0
+// and the offset, or -1 if the journal is full.
+int jctl_reserve(jctl_t *c, uint32_t len, uint32_t limit, uint32_t *off);
+
+// Passes the build turn on; the records of ticket t must be written.
+void jctl_built(jctl_t *c, uint32_t t);
+
+void jctl_wait_publish(jctl_t *c, uint32_t t);
+
+// Passes the publish turn on after the header covers nbytes (0: nothing
+// was published).
+void jctl_published(jctl_t *c, uint32_t t, uint32_t nbytes);
+
+// Stamps every item and drops the cache, for an exclusive ticket about to
+// change metadata behind the journal.
+void jctl_invalidate(jctl_t *c);
+
+// Ends an exclusive ticket; the on-disk journal now ends at nbytes. rewrote:
+// the ticket changed metadata other than by installing the journal.
+void jctl_end(jctl_t *c, uint32_t t, uint32_t nbytes, int rewrote);
+
+// By the publish holder, before jctl_published: the newest image of each
+// block, as of its commit.
+void jctl_cache_publish(jctl_t *c, uint32_t n, const uint32_t *block_no, const unsigned char *const *data);
+
+// Copies blocks, all as of one publish. Returns 0 if any is not cached or
+// the cache stays busy too long.
+int jctl_cache_read(const jctl_t *c, uint32_t n, const uint32_t *block_no, unsigned char *const *data);
+
+#endif
@@ -6,6 +6,12 @@
 #include <stdint.h>
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
+
+#include "blockdev.h"
+#include "jctl.h"
+#include "metrics.h"
+#include "probes.h"
 
 #define BLOCK_SIZE 4096U
 
@@ -19,6 +25,7 @@
 #define INODE_TABLE_BLOCKS 2U
 #define DATA_START_BLK     (INODE_TABLE_BLK + INODE_TABLE_BLOCKS) // 21
 #define DATA_BLOCKS        64U
+#define TOTAL_BLOCKS       (DATA_START_BLK + DATA_BLOCKS)        // 85
 
 #define INODE_SIZE 128U
 #define INODES_PER_BLOCK (BLOCK_SIZE / INODE_SIZE)
@@ -26,6 +33,8 @@
 
 #define DIRECT_POINTERS 8U
 
+#define FS_STATE_CLEAN 0x1U // set after a full checkpoint, cleared by the first journaled write
+
 // Journal format (internal to our tool; validator doesn't check journal contents)
 #define JOURNAL_MAGIC 0xdeadbeefU
 #define JOURNAL_BYTES (JOURNAL_BLOCKS * BLOCK_SIZE)
@@ -42,8 +51,45 @@ typedef struct {
 
 #define REC_DATA   1U
 #define REC_COMMIT 2U
+#define REC_PAD    3U // space between transactions to skip (see compact)
+#define REC_SPAN   4U // log streams only (see ship)
+
+// Commit records carry the transaction's sequence number and commit time.
+// Sequence numbers increase by one per transaction across installs (see
+// superblock.checkpoint_seq).
+typedef struct {
+    rec_header_t h;
+    uint32_t seq;
+    uint32_t time;
+} commit_rec_t;
+
+// Precedes the records of a compacted transaction in a log stream: the
+// transaction stands for every one from first_seq to its commit's seq.
+typedef struct {
+    rec_header_t h;
+    uint32_t first_seq;
+} span_rec_t;
 
 // On-disk structures (must match mkfs.c / validator.c)
+struct superblock {
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t inode_count;
+
+    uint32_t journal_block;
+    uint32_t inode_bitmap;
+    uint32_t data_bitmap;
+    uint32_t inode_start;
+    uint32_t data_start;
+
+    uint32_t state;
+    uint32_t checkpoint_seq; // sequence number of the last installed transaction
+    uint32_t install_gen;    // odd while install is rewriting home locations
+
+    uint8_t  _pad[128 - 12 * 4];
+};
+
 struct inode {
     uint16_t type;   // 0 free, 1 file, 2 dir
     uint16_t links;
@@ -59,25 +105,44 @@ struct dirent {
     char name[28];
 };
 
+_Static_assert(sizeof(struct superblock) == 128, "superblock must be 128 bytes");
 _Static_assert(sizeof(struct inode) == 128, "inode must be 128 bytes");
 _Static_assert(sizeof(struct dirent) == 32, "dirent must be 32 bytes");
 
+#define DIRENTS_PER_BLOCK (BLOCK_SIZE / sizeof(struct dirent))
+
 #define DATA_REC_SIZE   (sizeof(rec_header_t) + sizeof(uint32_t) + BLOCK_SIZE)
-#define COMMIT_REC_SIZE (sizeof(rec_header_t))
+#define COMMIT_REC_SIZE (sizeof(commit_rec_t))
+#define SPAN_REC_SIZE   (sizeof(span_rec_t))
 
 static void die(const char *msg) {
     perror(msg);
     exit(1);
 }
 
-static void read_block(int fd, uint32_t block_no, void *buf) {
-    off_t off = (off_t)block_no * BLOCK_SIZE;
-    if (pread(fd, buf, BLOCK_SIZE, off) != (ssize_t)BLOCK_SIZE) die("pread");
+static void read_block(blockdev_t *dev, uint32_t block_no, void *buf) {
+    if (bdev_read(dev, block_no, buf) != 0) die("read block");
+}
+
+static void write_block(blockdev_t *dev, uint32_t block_no, const void *buf) {
+    if (bdev_write(dev, block_no, buf) != 0) die("write block");
 }
 
-static void write_block(int fd, uint32_t block_no, const void *buf) {
-    off_t off = (off_t)block_no * BLOCK_SIZE;
-    if (pwrite(fd, buf, BLOCK_SIZE, off) != (ssize_t)BLOCK_SIZE) die("pwrite");
+static void sync_image(blockdev_t *dev) {
+    if (bdev_sync(dev) != 0) die("sync");
+}
+
+static void read_superblock(blockdev_t *dev, struct superblock *sb) {
+    uint8_t blk[BLOCK_SIZE];
+    read_block(dev, SUPERBLOCK_BLK, blk);
+    memcpy(sb, blk, sizeof(*sb));
+}
+
+static void write_superblock(blockdev_t *dev, const struct superblock *sb) {
+    uint8_t blk[BLOCK_SIZE];
+    read_block(dev, SUPERBLOCK_BLK, blk);
+    memcpy(blk, sb, sizeof(*sb));
+    write_block(dev, SUPERBLOCK_BLK, blk);
 }
 
 static int bitmap_test(const uint8_t *bm, uint32_t idx) {
@@ -88,18 +153,72 @@ static void bitmap_set(uint8_t *bm, uint32_t idx) {
     bm[idx / 8] |= (uint8_t)(1U << (idx % 8));
 }
 
-static void load_journal(int fd, unsigned char *jbuf) {
+static void load_journal(blockdev_t *dev, unsigned char *jbuf) {
     for (uint32_t i = 0; i < JOURNAL_BLOCKS; i++) {
-        read_block(fd, JOURNAL_START_BLK + i, jbuf + i * BLOCK_SIZE);
+        read_block(dev, JOURNAL_START_BLK + i, jbuf + i * BLOCK_SIZE);
     }
 }
 
-static void flush_journal(int fd, const unsigned char *jbuf) {
+static void flush_journal(blockdev_t *dev, const unsigned char *jbuf) {
     for (uint32_t i = 0; i < JOURNAL_BLOCKS; i++) {
-        write_block(fd, JOURNAL_START_BLK + i, jbuf + i * BLOCK_SIZE);
+        write_block(dev, JOURNAL_START_BLK + i, jbuf + i * BLOCK_SIZE);
     }
 }
 
+// Writes the journal blocks covering [from, to), leaving the header block for
+// last so a reader that sees the new nbytes also sees the records below it.
+// The records are durable before the header that commits them is written, and
+// the header is durable before an install can write home locations from them.
+static void flush_journal_append(blockdev_t *dev, const unsigned char *jbuf, uint32_t from, uint32_t to) {
+    int wrote = 0;
+    for (uint32_t i = from / BLOCK_SIZE; i * BLOCK_SIZE < to; i++) {
+        if (i == 0) continue;
+        write_block(dev, JOURNAL_START_BLK + i, jbuf + i * BLOCK_SIZE);
+        wrote = 1;
+    }
+    if (wrote) sync_image(dev);
+    write_block(dev, JOURNAL_START_BLK, jbuf);
+    sync_image(dev);
+}
+
+// Writes the records in [from, to) without syncing or publishing them. Block
+// 0 is shared with the header, which belongs to the publish turn, so the
+// on-disk header is kept. (No publish can be rewriting it meanwhile: a
+// record in block 0 means no earlier transaction since the last install
+// wrote any.)
+static void write_journal_records(blockdev_t *dev, const unsigned char *jbuf, uint32_t from, uint32_t to) {
+    for (uint32_t i = from / BLOCK_SIZE; i * BLOCK_SIZE < to; i++) {
+        if (i == 0) {
+            unsigned char blk[BLOCK_SIZE];
+            read_block(dev, JOURNAL_START_BLK, blk);
+            memcpy(blk + sizeof(journal_header_t), jbuf + sizeof(journal_header_t),
+                   BLOCK_SIZE - sizeof(journal_header_t));
+            write_block(dev, JOURNAL_START_BLK, blk);
+        } else {
+            write_block(dev, JOURNAL_START_BLK + i, jbuf + i * BLOCK_SIZE);
+        }
+    }
+}
+
+// Points the on-disk header at nbytes, committing every record below it.
+static void publish_journal_end(blockdev_t *dev, uint32_t nbytes) {
+    unsigned char blk[BLOCK_SIZE];
+    read_block(dev, JOURNAL_START_BLK, blk);
+    journal_header_t jh = { .magic = JOURNAL_MAGIC, .nbytes = nbytes };
+    memcpy(blk, &jh, sizeof(jh));
+    write_block(dev, JOURNAL_START_BLK, blk);
+    sync_image(dev);
+}
+
+static uint32_t disk_journal_end(blockdev_t *dev) {
+    unsigned char blk[BLOCK_SIZE];
+    journal_header_t jh;
+    read_block(dev, JOURNAL_START_BLK, blk);
+    memcpy(&jh, blk, sizeof(jh));
+    if (jh.magic != JOURNAL_MAGIC || jh.nbytes < sizeof(jh) || jh.nbytes > JOURNAL_BYTES) return sizeof(jh);
+    return jh.nbytes;
+}
+
 static void journal_init_if_needed(unsigned char *jbuf) {
     journal_header_t *jh = (journal_header_t *)jbuf;
     if (jh->magic != JOURNAL_MAGIC || jh->nbytes < sizeof(journal_header_t) || jh->nbytes > JOURNAL_BYTES) {
@@ -122,47 +241,48 @@ static void journal_append_data(unsigned char *jbuf, uint32_t *p_off, uint32_t b
     memcpy(jbuf + off, block_img, BLOCK_SIZE);
     off += BLOCK_SIZE;
 
+    VSFS_PROBE2(record_append, block_no, *p_off);
     *p_off = off;
 }
 
-static void journal_append_commit(unsigned char *jbuf, uint32_t *p_off) {
+static void journal_append_commit(unsigned char *jbuf, uint32_t *p_off, uint32_t seq, uint32_t time) {
     uint32_t off = *p_off;
-    rec_header_t rh = { .type = REC_COMMIT, .size = (uint32_t)COMMIT_REC_SIZE };
-    memcpy(jbuf + off, &rh, sizeof(rh));
-    off += (uint32_t)sizeof(rh);
+    commit_rec_t cr = { .h = { .type = REC_COMMIT, .size = (uint32_t)COMMIT_REC_SIZE }, .seq = seq, .time = time };
+    memcpy(jbuf + off, &cr, sizeof(cr));
+    off += (uint32_t)sizeof(cr);
     *p_off = off;
 }
 
-/* -------------------- install -------------------- */
-static void cmd_install(int fd) {
-    unsigned char *jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
-    if (!jbuf) die("malloc journal");
+typedef struct {
+    uint32_t block_no;
+    unsigned char *block_img; // points inside jbuf
+} pending_t;
 
-    load_journal(fd, jbuf);
-    journal_init_if_needed(jbuf);
+#define MAX_PENDING 128
 
+typedef void (*txn_fn)(const commit_rec_t *cr, const pending_t *recs, int cnt, void *arg);
+
+// Walks the journal and calls fn once per committed transaction, in log order.
+// Stops at the first malformed or incomplete record; returns the number of
+// committed transactions seen.
+static int journal_scan(unsigned char *jbuf, txn_fn fn, void *arg) {
     journal_header_t *jh = (journal_header_t *)jbuf;
 
     uint32_t start = (uint32_t)sizeof(journal_header_t);
     uint32_t end   = jh->nbytes;
     if (end > JOURNAL_BYTES) end = JOURNAL_BYTES;
 
-    typedef struct {
-        uint32_t block_no;
-        unsigned char *block_img; // points inside jbuf
-    } pending_t;
-
-    pending_t pending[128];
+    pending_t pending[MAX_PENDING];
     int pending_cnt = 0;
 
     uint32_t off = start;
-    int applied = 0;
+    int committed = 0;
 
     while (off + sizeof(rec_header_t) <= end) {
         rec_header_t *rh = (rec_header_t *)(jbuf + off);
 
         if (rh->size < sizeof(rec_header_t)) break;
-        if (off + rh->size > end) break;
+        if (rh->size > end - off) break; // also keeps off + size from wrapping
 
         if (rh->type == REC_DATA) {
             if (rh->size != DATA_REC_SIZE) break;
@@ -170,7 +290,7 @@ static void cmd_install(int fd) {
             uint32_t *bno_ptr = (uint32_t *)(jbuf + off + sizeof(rec_header_t));
             unsigned char *blk_img = (unsigned char *)(jbuf + off + sizeof(rec_header_t) + sizeof(uint32_t));
 
-            if (pending_cnt >= 128) break;
+            if (pending_cnt >= MAX_PENDING) break;
             pending[pending_cnt].block_no = *bno_ptr;
             pending[pending_cnt].block_img = blk_img;
             pending_cnt++;
@@ -180,104 +300,1680 @@ static void cmd_install(int fd) {
         } else if (rh->type == REC_COMMIT) {
             if (rh->size != COMMIT_REC_SIZE) break;
 
-            // Apply committed txn
-            for (int i = 0; i < pending_cnt; i++) {
-                write_block(fd, pending[i].block_no, pending[i].block_img);
-            }
-            applied++;
+            commit_rec_t cr;
+            memcpy(&cr, jbuf + off, sizeof(cr));
+            fn(&cr, pending, pending_cnt, arg);
+            committed++;
             pending_cnt = 0;
 
             off += rh->size;
 
+        } else if (rh->type == REC_PAD && rh->size <= JOURNAL_BYTES && pending_cnt == 0) {
+            off += rh->size;
+
         } else {
             break; // unknown record type
         }
     }
+    return committed;
+}
+
+/* -------------------- overlay -------------------- */
+
+// Newest committed image of each block still sitting in the journal, up to
+// max_seq. Readers go through the overlay so a transaction sees the effects
+// of earlier ones that have not been installed yet.
+typedef struct {
+    const unsigned char *img[TOTAL_BLOCKS];
+    uint32_t max_seq;  // ignore transactions newer than this
+    uint32_t last_seq; // newest transaction folded in, 0 if none
+} overlay_t;
+
+static void overlay_add_txn(const commit_rec_t *cr, const pending_t *recs, int cnt, void *arg) {
+    overlay_t *ov = (overlay_t *)arg;
+    if (cr->seq > ov->max_seq) return;
+    for (int i = 0; i < cnt; i++) {
+        if (recs[i].block_no < TOTAL_BLOCKS) ov->img[recs[i].block_no] = recs[i].block_img;
+    }
+    ov->last_seq = cr->seq;
+}
+
+static void overlay_build(overlay_t *ov, unsigned char *jbuf, uint32_t max_seq) {
+    memset(ov, 0, sizeof(*ov));
+    ov->max_seq = max_seq;
+    journal_scan(jbuf, overlay_add_txn, ov);
+}
+
+static void overlay_read(blockdev_t *dev, const overlay_t *ov, uint32_t block_no, void *buf) {
+    if (block_no < TOTAL_BLOCKS && ov->img[block_no]) {
+        memcpy(buf, ov->img[block_no], BLOCK_SIZE);
+        metrics_count(M_OVERLAY_HITS, 1);
+    } else {
+        read_block(dev, block_no, buf);
+        metrics_count(M_OVERLAY_MISSES, 1);
+    }
+}
+
+/* -------------------- operation trace -------------------- */
+// When VSFS_TRACE names a file, every create and install is appended to it as
+// a fixed-size record followed by the file name. Records are written with a
+// single O_APPEND write, so concurrent processes can share one trace.
+#define TRACE_MAGIC   0x52545356U // "VSTR"
+#define TRACE_VERSION 2U // 2: 64-bit durations
+#define TRACE_CREATE  1U
+#define TRACE_INSTALL 2U
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} trace_header_t;
+
+typedef struct {
+    uint64_t start_ns; // CLOCK_REALTIME when the operation began
+    uint64_t dur_ns;   // a create waiting out a long install can take seconds
+    uint8_t  op;
+    uint8_t  failed;
+    uint8_t  name_len; // bytes of name following the record
+    uint8_t  _pad[5];
+} trace_rec_t;
+
+_Static_assert(sizeof(trace_rec_t) == 24, "trace record must be 24 bytes");
+
+static int tracing_disabled = 0; // set while replaying a trace
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void trace_op(uint8_t op, int failed, const char *name, uint64_t start_ns) {
+    const char *path = getenv("VSFS_TRACE");
+    if (!path || !*path || tracing_disabled) return;
+
+    // The header, then one record and its name, so a new trace is written in
+    // one go and an existing one gets everything after the header.
+    unsigned char buf[sizeof(trace_header_t) + sizeof(trace_rec_t) + 255];
+    size_t name_len = name ? strnlen(name, 255) : 0;
+    trace_header_t th = { .magic = TRACE_MAGIC, .version = TRACE_VERSION };
+    trace_rec_t tr = { .start_ns = start_ns, .dur_ns = now_ns() - start_ns, .op = op,
+                       .failed = (uint8_t)(failed != 0), .name_len = (uint8_t)name_len };
+    size_t len = 0;
+    memcpy(buf, &th, sizeof(th));
+    len += sizeof(th);
+    memcpy(buf + len, &tr, sizeof(tr));
+    len += sizeof(tr);
+    if (name_len) memcpy(buf + len, name, name_len); // installs have no name
+    len += name_len;
+
+    for (;;) {
+        int tfd = open(path, O_RDWR | O_APPEND);
+        if (tfd >= 0) {
+            // Records of another version would make the whole trace unreadable.
+            trace_header_t old;
+            if (pread(tfd, &old, sizeof(old), 0) != (ssize_t)sizeof(old) || old.magic != TRACE_MAGIC ||
+                old.version != TRACE_VERSION) {
+                fprintf(stderr, "trace: '%s' is not a version %u trace; not recording\n", path, TRACE_VERSION);
+            } else if (write(tfd, buf + sizeof(th), len - sizeof(th)) != (ssize_t)(len - sizeof(th))) {
+                perror("write trace");
+            }
+            close(tfd);
+            return;
+        }
+        if (errno != ENOENT) break;
+
+        // A new trace is built under a private name and linked into place
+        // whole, so a concurrent appender never finds it without its header.
+        char tmp[4096];
+        snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+        tfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (tfd < 0) break;
+        int ok = write(tfd, buf, len) == (ssize_t)len;
+        close(tfd);
+        if (ok && link(tmp, path) == 0) {
+            unlink(tmp);
+            return;
+        }
+        int err = errno;
+        unlink(tmp);
+        errno = err;
+        if (!ok || err != EEXIST) break;
+        // Another process created it first; append to theirs.
+    }
+    perror("trace");
+}
+
+/* -------------------- install -------------------- */
+static void write_all(int fd, const void *buf, size_t len) {
+    const unsigned char *p = (const unsigned char *)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) die("write");
+        p += n;
+        len -= (size_t)n;
+    }
+}
+
+// Returns the number of bytes read; short only at end of stream.
+static size_t read_full(int fd, void *buf, size_t len) {
+    unsigned char *p = (unsigned char *)buf;
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, p + got, len - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) die("read");
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    return got;
+}
+
+typedef struct {
+    uint32_t first; // first seq the transaction stands for (see ship_txn)
+    uint32_t seq;
+    uint32_t time;
+    int cnt;
+    uint32_t block_no[MAX_PENDING];
+    unsigned char *imgs; // cnt * BLOCK_SIZE
+} stream_txn_t;
+
+// Reads the next transaction from a log stream. Returns 1 on success, 0 at a
+// clean end of stream, and -1 (after saying why) at a torn or malformed
+// record.
+static int read_stream_txn(int in, stream_txn_t *t) {
+    t->cnt = 0;
+    t->first = 0;
+    for (int n = 0;; n++) {
+        rec_header_t rh;
+        size_t got = read_full(in, &rh, sizeof(rh));
+        if (got == 0 && n == 0) return 0;
+        if (got != sizeof(rh)) break;
+        if (rh.type == REC_SPAN && rh.size == SPAN_REC_SIZE && t->cnt == 0) {
+            if (read_full(in, &t->first, sizeof(t->first)) != sizeof(t->first)) break;
+        } else if (rh.type == REC_DATA && rh.size == DATA_REC_SIZE && t->cnt < MAX_PENDING) {
+            if (read_full(in, &t->block_no[t->cnt], sizeof(uint32_t)) != sizeof(uint32_t)) break;
+            if (read_full(in, t->imgs + (size_t)t->cnt * BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE) break;
+            t->cnt++;
+        } else if (rh.type == REC_COMMIT && rh.size == COMMIT_REC_SIZE) {
+            if (read_full(in, &t->seq, sizeof(t->seq)) != sizeof(t->seq)) break;
+            if (read_full(in, &t->time, sizeof(t->time)) != sizeof(t->time)) break;
+            if (t->first == 0) t->first = t->seq;
+            return 1;
+        } else {
+            fprintf(stderr, "log stream: malformed record (type %u size %u)\n", rh.type, rh.size);
+            return -1;
+        }
+    }
+    fprintf(stderr, "log stream: torn transaction at the end\n");
+    return -1;
+}
+
+// Positions a log file for appending after its last complete transaction,
+// cutting off a torn or malformed tail (left by a crash mid-append) that
+// would otherwise hide everything appended after it. Returns the last
+// transaction's seq, 0 if none.
+static uint32_t trim_stream(int fd, const char *tag) {
+    stream_txn_t t;
+    t.imgs = (unsigned char *)malloc((size_t)MAX_PENDING * BLOCK_SIZE);
+    if (!t.imgs) die("malloc stream");
+    if (lseek(fd, 0, SEEK_SET) < 0) die("lseek log");
+    uint32_t last = 0;
+    off_t good = 0;
+    while (read_stream_txn(fd, &t) > 0) {
+        last = t.seq;
+        good = lseek(fd, 0, SEEK_CUR);
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < 0) die("lseek log");
+    if (size > good) {
+        if (ftruncate(fd, good) != 0 || fsync(fd) != 0) die("truncate log");
+        fprintf(stderr, "%s: dropped %lld byte(s) after seq %u\n", tag, (long long)(size - good), last);
+    }
+    free(t.imgs);
+    return last;
+}
+
+typedef struct {
+    unsigned char *buf;
+    uint32_t len;
+    uint32_t after;     // only transactions newer than this are shipped
+    uint32_t prev;      // seq of the transaction before the next one scanned
+    uint32_t first_seq; // first shipped, 0 if none
+    uint32_t last_seq;
+} ship_ctx_t;
+
+// A compacted transaction follows its predecessor by more than one seq; the
+// gap it covers is sent ahead of it as a span record.
+static void ship_txn(const commit_rec_t *cr, const pending_t *recs, int cnt, void *arg) {
+    ship_ctx_t *sc = (ship_ctx_t *)arg;
+    uint32_t first = sc->prev + 1;
+    sc->prev = cr->seq;
+    if (cr->seq <= sc->after) return;
+    if (first != cr->seq) {
+        span_rec_t sr = { .h = { .type = REC_SPAN, .size = (uint32_t)SPAN_REC_SIZE }, .first_seq = first };
+        memcpy(sc->buf + sc->len, &sr, sizeof(sr));
+        sc->len += (uint32_t)sizeof(sr);
+    }
+    for (int i = 0; i < cnt; i++) {
+        journal_append_data(sc->buf, &sc->len, recs[i].block_no, recs[i].block_img);
+    }
+    journal_append_commit(sc->buf, &sc->len, cr->seq, cr->time);
+    if (sc->first_seq == 0) sc->first_seq = first;
+    sc->last_seq = cr->seq;
+}
+
+typedef struct {
+    blockdev_t *dev;
+    uint32_t last_seq;
+    uint32_t blocks; // home blocks written
+} install_ctx_t;
+
+static void install_txn(const commit_rec_t *cr, const pending_t *recs, int cnt, void *arg) {
+    install_ctx_t *ic = (install_ctx_t *)arg;
+    for (int i = 0; i < cnt; i++) {
+        write_block(ic->dev, recs[i].block_no, recs[i].block_img);
+    }
+    ic->blocks += (uint32_t)cnt;
+    if (cr->seq > ic->last_seq) ic->last_seq = cr->seq;
+}
+
+// Appends the journal's committed transactions to an archive in log stream
+// format, durably, so they outlive the journal clear that follows. A torn
+// tail from a crashed append is cut off first, and transactions the archive
+// already holds (archived before a crash cleared the journal) are skipped.
+static void archive_journal(unsigned char *jbuf, uint32_t after, const char *archive_path) {
+    int afd = open(archive_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (afd < 0) die("open archive");
+    uint32_t last = trim_stream(afd, "install");
+    ship_ctx_t sc = { .buf = (unsigned char *)malloc(JOURNAL_BYTES), .after = last > after ? last : after,
+                      .prev = after };
+    if (!sc.buf) die("malloc archive");
+    journal_scan(jbuf, ship_txn, &sc);
+    if (sc.len > 0) {
+        write_all(afd, sc.buf, sc.len);
+        if (fsync(afd) != 0) die("fsync archive");
+    }
+    if (close(afd) < 0) die("close archive");
+    free(sc.buf);
+}
+
+// Applies every committed transaction to its home location and clears the
+// journal, archiving it first if archive_path is set. Returns the number
+// applied, or -1 if the image was already clean.
+static int install_journal(blockdev_t *dev, const char *archive_path) {
+    struct superblock sb;
+    read_superblock(dev, &sb);
+    if (sb.state & FS_STATE_CLEAN) return -1;
+
+    unsigned char *jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
+    if (!jbuf) die("malloc journal");
+
+    load_journal(dev, jbuf);
+    journal_init_if_needed(jbuf);
+    VSFS_PROBE2(checkpoint_start, sb.checkpoint_seq, ((journal_header_t *)jbuf)->nbytes);
+    if (archive_path) archive_journal(jbuf, sb.checkpoint_seq, archive_path);
+
+    // Snapshot readers retry if install_gen moves (or is odd) under them. An
+    // install interrupted by a crash leaves it odd; move it on regardless.
+    sb.install_gen += (sb.install_gen & 1U) ? 2U : 1U;
+    write_superblock(dev, &sb);
+
+    install_ctx_t ic = { .dev = dev, .last_seq = sb.checkpoint_seq };
+    int applied = journal_scan(jbuf, install_txn, &ic);
+
+    // Home locations must be durable before the journal that redoes them goes away.
+    sync_image(dev);
 
     // Clear journal after install
     memset(jbuf, 0, JOURNAL_BYTES);
-    jh = (journal_header_t *)jbuf;
+    journal_header_t *jh = (journal_header_t *)jbuf;
     jh->magic = JOURNAL_MAGIC;
     jh->nbytes = (uint32_t)sizeof(journal_header_t);
-    flush_journal(fd, jbuf);
+    flush_journal(dev, jbuf);
+
+    sb.state |= FS_STATE_CLEAN;
+    sb.checkpoint_seq = ic.last_seq;
+    sb.install_gen++;
+    write_superblock(dev, &sb);
+    sync_image(dev);
+    VSFS_PROBE2(checkpoint_end, applied, sb.checkpoint_seq);
+    if (applied > 0) {
+        metrics_count(M_CHECKPOINTS, 1);
+        metrics_count(M_CHECKPOINT_TXNS, (uint64_t)applied);
+        metrics_count(M_CHECKPOINT_BYTES, (uint64_t)ic.blocks * BLOCK_SIZE);
+    }
+    metrics_set(G_JOURNAL_BYTES, sizeof(journal_header_t));
+    metrics_set(G_CHECKPOINT_SEQ, sb.checkpoint_seq);
 
     free(jbuf);
+    return applied;
+}
+
+/* -------------------- commit sequencing -------------------- */
+// Writers coordinate through the image's control block (see jctl.h): creates
+// build in ticket order, sync concurrently and publish in ticket order;
+// install and apply hold the sequencer exclusively. Without a control block
+// (ram backend) every step below is local.
+static jctl_t *ctl;
+
+#define TXN_CACHED_BLOCKS 4U
+_Static_assert(JCTL_BLOCK_SIZE == BLOCK_SIZE, "control block cache holds whole blocks");
+
+typedef struct {
+    uint32_t start, end; // journal bytes written by the transaction
+    // Metadata blocks as of the transaction, for the control block's cache
+    uint32_t ncached;
+    uint32_t cached_no[TXN_CACHED_BLOCKS];
+    unsigned char cached[TXN_CACHED_BLOCKS][BLOCK_SIZE];
+} txn_span_t;
+
+// Takes a ticket and waits for its build turn.
+static uint32_t txn_enter(blockdev_t *dev, int exclusive) {
+    if (!ctl) return 0;
+    uint32_t t = jctl_begin(ctl, exclusive);
+    if (jctl_stale(ctl, t)) jctl_resync(ctl, disk_journal_end(dev));
+    return t;
+}
+
+// rewrote: metadata changed other than by installing the journal.
+static void txn_exit(blockdev_t *dev, uint32_t t, int rewrote) {
+    if (ctl) jctl_end(ctl, t, disk_journal_end(dev), rewrote);
+}
+
+// Takes a ticket without waiting for a turn, so the transaction can plan
+// meanwhile.
+static uint32_t txn_ticket(void) {
+    return ctl ? jctl_ticket(ctl, 0) : 0;
+}
+
+static void txn_wait_build(blockdev_t *dev, uint32_t t) {
+    if (!ctl) return;
+    jctl_wait_build(ctl, t);
+    if (jctl_stale(ctl, t)) jctl_resync(ctl, disk_journal_end(dev));
+}
+
+static int journal_reserve(const journal_header_t *jh, uint32_t needed, uint32_t *off) {
+    if (ctl) return jctl_reserve(ctl, needed, JOURNAL_BYTES, off);
+    if (jh->nbytes + needed > JOURNAL_BYTES) return -1;
+    *off = jh->nbytes;
+    return 0;
+}
+
+// Passes the build turn on, makes the records durable while later tickets
+// build, then publishes them in ticket order. The records are durable before
+// the header that commits them, and the header before any install reads it.
+static void txn_commit(blockdev_t *dev, uint32_t t, const txn_span_t *span) {
+    int wrote = span->end > span->start;
+    if (ctl) jctl_built(ctl, t);
+    if (wrote) sync_image(dev);
+    if (ctl) jctl_wait_publish(ctl, t);
+    if (wrote) publish_journal_end(dev, span->end);
+    if (ctl && wrote) {
+        const unsigned char *imgs[TXN_CACHED_BLOCKS];
+        for (uint32_t i = 0; i < span->ncached; i++) imgs[i] = span->cached[i];
+        jctl_cache_publish(ctl, span->ncached, span->cached_no, imgs);
+    }
+    if (ctl) jctl_published(ctl, t, wrote ? span->end : 0);
+}
+
+static int install_exclusive(blockdev_t *dev, const char *archive_path) {
+    uint32_t t = txn_enter(dev, 1);
+    int applied = install_journal(dev, archive_path);
+    txn_exit(dev, t, 0);
+    return applied;
+}
+
+static void cmd_install(blockdev_t *dev, const char *archive_path) {
+    uint64_t start = now_ns();
+    int applied = install_exclusive(dev, archive_path);
+    trace_op(TRACE_INSTALL, 0, NULL, start);
+    if (applied < 0) {
+        printf("install: image is clean, nothing to install\n");
+        return;
+    }
     printf("install: applied %d committed transaction(s), cleared journal\n", applied);
 }
 
-/* -------------------- create -------------------- */
-static void cmd_create(int fd, const char *name) {
-    // Basic filename rules: must fit in dirent.name (28 incl null)
-    if (!name || name[0] == '\0') {
-        fprintf(stderr, "create: empty name not allowed\n");
-        exit(1);
+// Clears the clean flag ahead of the first append; it must be durable before
+// anything can be replayed from the journal.
+static void mark_dirty(blockdev_t *dev, struct superblock *sb) {
+    if (!(sb->state & FS_STATE_CLEAN)) return;
+    sb->state &= ~FS_STATE_CLEAN;
+    write_superblock(dev, sb);
+    sync_image(dev);
+}
+
+/* -------------------- compact -------------------- */
+// Folds the journal's committed transactions into one holding the newest
+// image of each block, under the newest commit's seq and time. This frees
+// journal space without the home writes of an install. The journal recovers
+// to the same image after every step:
+//   1. the folded transaction is written past the end, uncommitted
+//   2. block 0 switches to a header covering it and a pad record skipping
+//      everything before it
+//   3. it is copied to the front, inside the skipped space
+//   4. block 0 switches to a header ending after the front copy
+// The header and the pad record share a sector, so each switch is atomic.
+// Readers retry around the rewrite on install_gen, as around an install.
+#define COMPACT_START ((uint32_t)(sizeof(journal_header_t) + sizeof(rec_header_t))) // after the pad
+
+typedef struct {
+    int txns;
+    uint32_t last_time;
+} compact_ctx_t;
+
+static void compact_count(const commit_rec_t *cr, const pending_t *recs, int cnt, void *arg) {
+    compact_ctx_t *cc = (compact_ctx_t *)arg;
+    (void)recs;
+    (void)cnt;
+    cc->txns++;
+    cc->last_time = cr->time;
+}
+
+// Points block 0 at a journal ending at nbytes whose first record is a pad
+// of pad bytes.
+static void compact_switch(blockdev_t *dev, unsigned char *jbuf, uint32_t nbytes, uint32_t pad) {
+    journal_header_t jh = { .magic = JOURNAL_MAGIC, .nbytes = nbytes };
+    rec_header_t rh = { .type = REC_PAD, .size = pad };
+    memcpy(jbuf, &jh, sizeof(jh));
+    memcpy(jbuf + sizeof(jh), &rh, sizeof(rh));
+    write_block(dev, JOURNAL_START_BLK, jbuf);
+    sync_image(dev);
+}
+
+// Returns the number of transactions folded, 0 if folding would free
+// nothing, or -1 if the folded transaction does not fit past the end of the
+// journal. The bytes freed go to *freed.
+static int compact_journal(blockdev_t *dev, uint32_t *freed) {
+    *freed = 0;
+    struct superblock sb;
+    read_superblock(dev, &sb);
+    if (sb.state & FS_STATE_CLEAN) return 0;
+
+    unsigned char *jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
+    unsigned char *folded = (unsigned char *)malloc(JOURNAL_BYTES);
+    if (!jbuf || !folded) die("malloc compact");
+    load_journal(dev, jbuf);
+    journal_init_if_needed(jbuf);
+    uint32_t end = ((journal_header_t *)jbuf)->nbytes;
+
+    static overlay_t ov;
+    compact_ctx_t cc = { 0, 0 };
+    overlay_build(&ov, jbuf, UINT32_MAX);
+    journal_scan(jbuf, compact_count, &cc);
+
+    // Laid out at its final offset, so folded[COMPACT_START, len) is the copy.
+    uint32_t len = COMPACT_START;
+    for (uint32_t b = 0; b < TOTAL_BLOCKS; b++) {
+        if (ov.img[b]) journal_append_data(folded, &len, b, ov.img[b]);
     }
-    if (strlen(name) >= 28) {
-        fprintf(stderr, "create: name too long (max 27 chars)\n");
-        exit(1);
+    journal_append_commit(folded, &len, ov.last_seq, cc.last_time);
+    uint32_t m = len - COMPACT_START;
+
+    int ret = cc.txns;
+    if (cc.txns < 2 || len >= end) {
+        ret = 0;
+    } else if (end + m > JOURNAL_BYTES) {
+        ret = -1;
     }
-    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
-        fprintf(stderr, "create: invalid name\n");
-        exit(1);
+    if (ret <= 0) {
+        free(folded);
+        free(jbuf);
+        return ret;
     }
 
-    // Read inode bitmap
-    uint8_t inode_bm[BLOCK_SIZE];
-    read_block(fd, INODE_BITMAP_BLK, inode_bm);
+    VSFS_PROBE2(compact_start, end, len);
+    sb.install_gen += (sb.install_gen & 1U) ? 2U : 1U;
+    write_superblock(dev, &sb);
 
-    // Find a free inode (skip 0, root)
-    int new_ino = -1;
-    for (uint32_t i = 1; i < INODE_COUNT; i++) {
-        if (!bitmap_test(inode_bm, i)) { new_ino = (int)i; break; }
+    memcpy(jbuf + end, folded + COMPACT_START, m);
+    for (uint32_t i = end / BLOCK_SIZE; i * BLOCK_SIZE < end + m; i++) {
+        write_block(dev, JOURNAL_START_BLK + i, jbuf + i * BLOCK_SIZE);
     }
-    if (new_ino < 0) {
-        fprintf(stderr, "create: no free inode available\n");
+    sync_image(dev);
+    compact_switch(dev, jbuf, end + m, end - (uint32_t)sizeof(journal_header_t));
+
+    memcpy(jbuf + COMPACT_START, folded + COMPACT_START, m);
+    for (uint32_t i = 0; i * BLOCK_SIZE < len; i++) {
+        write_block(dev, JOURNAL_START_BLK + i, jbuf + i * BLOCK_SIZE);
+    }
+    sync_image(dev);
+    compact_switch(dev, jbuf, len, (uint32_t)sizeof(rec_header_t));
+
+    sb.install_gen++;
+    write_superblock(dev, &sb);
+    sync_image(dev);
+
+    *freed = end - len;
+    VSFS_PROBE2(compact_end, cc.txns, *freed);
+    metrics_count(M_COMPACTIONS, 1);
+    metrics_count(M_COMPACTION_BYTES, *freed);
+    metrics_set(G_JOURNAL_BYTES, len);
+
+    free(folded);
+    free(jbuf);
+    return ret;
+}
+
+// Compaction changes no metadata, so plans made before it stay valid.
+static int compact_exclusive(blockdev_t *dev, uint32_t *freed) {
+    uint32_t t = txn_enter(dev, 1);
+    int folded = compact_journal(dev, freed);
+    txn_exit(dev, t, 0);
+    return folded;
+}
+
+static void cmd_compact(blockdev_t *dev) {
+    uint32_t freed;
+    int folded = compact_exclusive(dev, &freed);
+    if (folded < 0) {
+        fprintf(stderr, "compact: no room past the journal's end to stage the folded transaction; "
+                        "run ./journal install\n");
         exit(1);
     }
+    if (folded == 0) {
+        printf("compact: nothing to fold\n");
+        return;
+    }
+    printf("compact: folded %d committed transaction(s) into one, freed %u journal byte(s)\n", folded, freed);
+}
 
-    // Read inode table blocks
-    uint8_t itbl0[BLOCK_SIZE], itbl1[BLOCK_SIZE];
-    read_block(fd, INODE_TABLE_BLK + 0, itbl0);
-    read_block(fd, INODE_TABLE_BLK + 1, itbl1);
+/* -------------------- tuning -------------------- */
+// Batching and journal space follow the observed workload instead of fixed
+// constants. The workload is read from the journal itself: commit rate from
+// commit times, the newest transaction's size, and absorption, the share of
+// logged bytes a compaction would drop because later transactions logged the
+// same blocks again. apply adds its measured arrival and flush times, creates
+// their commit latency. Three settings follow, each kept within bounds from
+// VSFS_TUNE (default "window=0-50,headroom=1-8,batch=1-64,absorb=50"):
+//   window    ms apply waits for more transactions to share one journal
+//             flush: a flush's time, if the next one is due sooner
+//   headroom  transactions of journal space a VSFS_COMPACT create keeps free
+//             for those in flight (seen in the control block, or by Little's
+//             law) plus the next one; it compacts while that and the staged
+//             copy still fit and compaction absorbs >= absorb%, else installs
+//   batch     transactions apply journals before installing them: more the
+//             more the journal absorbs, as an install writes each block once
+//             however often it was logged
+// Changed settings and the checkpoints they cause are logged to stderr.
+#define TUNE_ALPHA 0.2 // weight of the newest sample in running averages
 
-    struct inode *inodes0 = (struct inode *)itbl0;
-    struct inode *inodes1 = (struct inode *)itbl1;
+typedef struct {
+    uint32_t lo, hi;
+} tune_range_t;
 
-    // Root inode is inode 0
-    struct inode root = inodes0[0];
+typedef struct {
+    tune_range_t window_ms, headroom, batch;
+    uint32_t absorb_pct;
+} tune_conf_t;
+
+typedef struct {
+    double rate;        // commits per second
+    double txn_bytes;   // journal bytes of the newest transaction
+    double absorption;  // 0..1
+    uint32_t folded;    // journal bytes the transactions compact to
+    double flush_secs;  // one journal flush, 0 if unknown
+    double commit_secs; // one commit, 0 if unknown
+    uint32_t inflight;  // transactions seen waiting to build
+} workload_t;
+
+typedef struct {
+    uint32_t window_ms, headroom, batch;
+} tune_t;
+
+static const tune_conf_t *tune_conf(void) {
+    static tune_conf_t conf = { { 0, 50 }, { 1, 8 }, { 1, 64 }, 50 };
+    static int parsed;
+    if (parsed) return &conf;
+    parsed = 1;
+    const char *env = getenv("VSFS_TUNE");
+    if (!env) return &conf;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", env);
+    for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        char key[16];
+        unsigned lo, hi;
+        int n = sscanf(tok, "%15[a-z]=%u-%u", key, &lo, &hi);
+        tune_range_t *r = NULL;
+        if (n == 3 && lo <= hi) {
+            if (strcmp(key, "window") == 0) r = &conf.window_ms;
+            if (strcmp(key, "headroom") == 0) r = &conf.headroom;
+            if (strcmp(key, "batch") == 0) r = &conf.batch;
+        }
+        if (n == 2 && strcmp(key, "absorb") != 0) {
+            if (strcmp(key, "window") == 0) r = &conf.window_ms;
+            if (strcmp(key, "headroom") == 0) r = &conf.headroom;
+            if (strcmp(key, "batch") == 0) r = &conf.batch;
+            hi = lo; // a fixed setting
+        }
+        if (r) {
+            r->lo = lo;
+            r->hi = hi;
+        } else if (n == 2 && strcmp(key, "absorb") == 0 && lo <= 100) {
+            conf.absorb_pct = lo;
+        } else {
+            fprintf(stderr, "journal: VSFS_TUNE: ignoring '%s'\n", tok);
+        }
+    }
+    if (conf.headroom.lo == 0) conf.headroom.lo = 1;
+    if (conf.batch.lo == 0) conf.batch.lo = 1;
+    if (conf.headroom.hi < conf.headroom.lo) conf.headroom.hi = conf.headroom.lo;
+    if (conf.batch.hi < conf.batch.lo) conf.batch.hi = conf.batch.lo;
+    return &conf;
+}
+
+static double ewma(double avg, double sample) {
+    return avg == 0 ? sample : avg + TUNE_ALPHA * (sample - avg);
+}
+
+typedef struct {
+    workload_t *w;
+    uint8_t seen[TOTAL_BLOCKS];
+    uint32_t blocks;
+    int txns;
+    uint32_t first_seq, first_time, last_seq, last_time;
+} workload_scan_t;
+
+static void workload_txn(const commit_rec_t *cr, const pending_t *recs, int cnt, void *arg) {
+    workload_scan_t *ws = (workload_scan_t *)arg;
+    for (int i = 0; i < cnt; i++) {
+        if (recs[i].block_no < TOTAL_BLOCKS && !ws->seen[recs[i].block_no]) {
+            ws->seen[recs[i].block_no] = 1;
+            ws->blocks++;
+        }
+    }
+    if (ws->txns++ == 0) {
+        ws->first_seq = cr->seq;
+        ws->first_time = cr->time;
+    }
+    ws->last_seq = cr->seq;
+    ws->last_time = cr->time;
+    ws->w->txn_bytes = (double)cnt * DATA_REC_SIZE + COMMIT_REC_SIZE;
+}
+
+// Leaves flush_secs and commit_secs to the caller.
+static void journal_workload(unsigned char *jbuf, workload_t *w) {
+    static workload_scan_t ws;
+    memset(&ws, 0, sizeof(ws));
+    memset(w, 0, sizeof(*w));
+    ws.w = w;
+    journal_scan(jbuf, workload_txn, &ws);
+    if (ws.txns == 0) return;
+    uint32_t logged = ((journal_header_t *)jbuf)->nbytes - (uint32_t)sizeof(journal_header_t);
+    w->folded = ws.blocks * (uint32_t)DATA_REC_SIZE + (uint32_t)COMMIT_REC_SIZE;
+    w->absorption = logged > w->folded ? 1.0 - (double)w->folded / logged : 0.0;
+    // Seqs, not transactions, so a compacted one counts as one commit at its
+    // time. Commit times have one-second resolution.
+    if (ws.last_seq > ws.first_seq) {
+        uint32_t secs = ws.last_time > ws.first_time ? ws.last_time - ws.first_time : 1;
+        w->rate = (double)(ws.last_seq - ws.first_seq) / secs;
+    }
+}
+
+static uint32_t tune_clamp(double v, tune_range_t r) {
+    if (v <= r.lo) return r.lo;
+    if (v >= r.hi) return r.hi;
+    return (uint32_t)(v + 0.5);
+}
+
+static void tune(const tune_conf_t *c, const workload_t *w, tune_t *t) {
+    int due = w->rate > 0 && w->flush_secs * w->rate > 1.0;
+    t->window_ms = tune_clamp(due ? w->flush_secs * 1000.0 : 0.0, c->window_ms);
+    double inflight = w->rate * w->commit_secs;
+    if (w->inflight > inflight) inflight = w->inflight;
+    t->headroom = tune_clamp(inflight + 1.0, c->headroom);
+    // Leave room for one commit past the headroom in an empty journal, or
+    // every commit would checkpoint.
+    if (w->txn_bytes > 0) {
+        uint32_t fits = (uint32_t)((JOURNAL_BYTES - sizeof(journal_header_t)) / w->txn_bytes);
+        if (t->headroom + 1 > fits) t->headroom = fits > 1 ? fits - 1 : 1;
+    }
+    t->batch = tune_clamp(c->batch.lo + (c->batch.hi - c->batch.lo) * w->absorption, c->batch);
+}
+
+static void tune_log(const char *tag, const workload_t *w, const char *what) {
+    fprintf(stderr, "%s: tune: %s (%.1f commit(s)/s, %.0f byte(s)/txn, absorption %.0f%%)\n", tag, what, w->rate,
+            w->txn_bytes, w->absorption * 100.0);
+}
+
+// True if compaction absorbs enough to be worth it and leaves room for
+// `room` bytes of new transactions.
+static int tune_compacts(const tune_conf_t *c, const workload_t *w, double room) {
+    return w->absorption * 100.0 >= c->absorb_pct && COMPACT_START + w->folded + room <= JOURNAL_BYTES;
+}
+
+// With VSFS_COMPACT set, a create compacts the journal when the next commit
+// would leave too little room to stage the folded copy behind those in
+// flight, or installs it once less than the headroom is left. `need` is the
+// room a create refused by a full journal must find (0 after a commit). The
+// journal is read without a turn; the checkpoint itself takes an exclusive
+// ticket, and a compaction that finds nothing to fold (another writer got
+// there first) is left at that. Returns 0 if VSFS_COMPACT is unset.
+static int auto_checkpoint(blockdev_t *dev, double commit_secs, uint32_t need) {
+    const char *env = getenv("VSFS_COMPACT");
+    if (!env || !*env) return 0;
+    const tune_conf_t *conf = tune_conf();
+
+    unsigned char *jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
+    if (!jbuf) die("malloc journal");
+    load_journal(dev, jbuf);
+    journal_init_if_needed(jbuf);
+    uint32_t end = ((journal_header_t *)jbuf)->nbytes;
+    workload_t w;
+    journal_workload(jbuf, &w);
+    free(jbuf);
+    w.commit_secs = commit_secs;
+    if (ctl) w.inflight = jctl_waiting(ctl);
+    tune_t t;
+    tune(conf, &w, &t);
+    double room = t.headroom * w.txn_bytes, left = JOURNAL_BYTES - end;
+    if (room < need) room = need;
+
+    char what[128];
+    uint32_t freed;
+    if (tune_compacts(conf, &w, room) && left >= room + w.folded) {
+        if (left - w.txn_bytes >= room + w.folded) return 1;
+        int folded = compact_exclusive(dev, &freed);
+        if (folded > 0) {
+            snprintf(what, sizeof(what), "journal %u/%u byte(s), headroom %u txn(s): compacted %d, freed %u", end,
+                     JOURNAL_BYTES, t.headroom, folded, freed);
+            tune_log("create", &w, what);
+        }
+        if (folded >= 0) return 1;
+    }
+    if (left >= room) return 1;
+    int applied = install_exclusive(dev, NULL);
+    if (applied > 0) {
+        snprintf(what, sizeof(what), "journal %u/%u byte(s), headroom %u txn(s): installed %d", end,
+                 JOURNAL_BYTES, t.headroom, applied);
+        tune_log("create", &w, what);
+    }
+    return 1;
+}
+
+/* -------------------- snapshot -------------------- */
+#define SNAPSHOT_RETRIES 100
+
+// Copies the image as of commit `want` (UINT32_MAX = newest) to out_path.
+// Nothing is locked: create only appends to the journal and never touches
+// home locations, whose versions the journal preserves until install. An
+// install racing with the copy moves install_gen, and the copy is retried.
+static void cmd_snapshot(blockdev_t *dev, const char *out_path, uint32_t want) {
+    unsigned char *jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
+    unsigned char *img = (unsigned char *)malloc((size_t)TOTAL_BLOCKS * BLOCK_SIZE);
+    if (!jbuf || !img) die("malloc snapshot");
+
+    static overlay_t ov;
+    struct superblock sb, sb_after;
+    uint32_t seq = 0;
+    int attempt;
+
+    for (attempt = 1; attempt <= SNAPSHOT_RETRIES; attempt++) {
+        read_superblock(dev, &sb);
+        if (sb.install_gen & 1U) {
+            usleep(1000);
+            continue;
+        }
+        if (want < sb.checkpoint_seq) {
+            fprintf(stderr, "snapshot: seq %u already checkpointed; oldest available is %u\n",
+                    want, sb.checkpoint_seq);
+            exit(1);
+        }
+
+        memset(&ov, 0, sizeof(ov));
+        if (!(sb.state & FS_STATE_CLEAN)) {
+            load_journal(dev, jbuf);
+            journal_init_if_needed(jbuf);
+            overlay_build(&ov, jbuf, want);
+        }
+        seq = ov.last_seq > sb.checkpoint_seq ? ov.last_seq : sb.checkpoint_seq;
+
+        for (uint32_t b = INODE_BITMAP_BLK; b < TOTAL_BLOCKS; b++) {
+            overlay_read(dev, &ov, b, img + (size_t)b * BLOCK_SIZE);
+        }
 
-    if (root.type != 2) {
-        fprintf(stderr, "create: root inode is not a directory\n");
+        read_superblock(dev, &sb_after);
+        if (sb_after.install_gen == sb.install_gen) break;
+    }
+    if (attempt > SNAPSHOT_RETRIES) {
+        fprintf(stderr, "snapshot: install in progress or interrupted (run ./journal install); giving up\n");
         exit(1);
     }
-    if (root.direct[0] == 0) {
-        fprintf(stderr, "create: root directory has no data block\n");
+    if (want != UINT32_MAX && seq != want) {
+        fprintf(stderr, "snapshot: seq %u is not committed or was compacted (newest at or before it is %u)\n",
+                want, seq);
         exit(1);
     }
 
-    uint32_t root_dir_blk = root.direct[0];
+    // The copy is a standalone, already-checkpointed image.
+    memset(img, 0, (size_t)INODE_BITMAP_BLK * BLOCK_SIZE);
+    sb.state = FS_STATE_CLEAN;
+    sb.checkpoint_seq = seq;
+    sb.install_gen = 0;
+    memcpy(img, &sb, sizeof(sb));
+
+    blockdev_t *out = bdev_open(out_path, BDEV_CREATE, TOTAL_BLOCKS);
+    if (!out) die("open snapshot");
+    for (uint32_t b = 0; b < TOTAL_BLOCKS; b++) {
+        write_block(out, b, img + (size_t)b * BLOCK_SIZE);
+    }
+    sync_image(out);
+    bdev_close(out);
 
-    // Read root directory block
-    uint8_t dirblk[BLOCK_SIZE];
-    read_block(fd, root_dir_blk, dirblk);
-    struct dirent *des = (struct dirent *)dirblk;
+    free(img);
+    free(jbuf);
+    printf("snapshot: wrote '%s' as of seq %u (%d attempt(s))\n", out_path, seq, attempt);
+}
+
+/* -------------------- log shipping -------------------- */
+// A log stream is the journal's own record format (DATA records followed by a
+// COMMIT), one committed transaction after another, in sequence order. A
+// transaction compacted from several starts with a SPAN record.
+#define SHIP_RETRIES 100
+#define APPLY_IDLE_MS 200 // install the replica's journal after this long without input
+
+// Reads the superblock and journal as of one moment, retrying around install.
+static void load_journal_stable(blockdev_t *dev, unsigned char *jbuf, struct superblock *sb) {
+    for (int attempt = 0; attempt < SHIP_RETRIES; attempt++) {
+        struct superblock after;
+        read_superblock(dev, sb);
+        if (sb->install_gen & 1U) {
+            usleep(1000);
+            continue;
+        }
+        load_journal(dev, jbuf);
+        journal_init_if_needed(jbuf);
+        read_superblock(dev, &after);
+        if (after.install_gen == sb->install_gen) return;
+    }
+    fprintf(stderr, "install in progress or interrupted (run ./journal install)\n");
+    exit(1);
+}
+
+// Newest committed sequence number of an image, installed or not.
+static uint32_t newest_seq(blockdev_t *dev) {
+    unsigned char *jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
+    if (!jbuf) die("malloc journal");
+    struct superblock sb;
+    static overlay_t ov;
+    memset(&ov, 0, sizeof(ov));
+    load_journal_stable(dev, jbuf, &sb);
+    if (!(sb.state & FS_STATE_CLEAN)) overlay_build(&ov, jbuf, UINT32_MAX);
+    free(jbuf);
+    return ov.last_seq > sb.checkpoint_seq ? ov.last_seq : sb.checkpoint_seq;
+}
+
+// Streams committed transactions newer than `from` to out_path ("-" for
+// stdout). With no explicit `from`, an existing log file is resumed after its
+// last transaction. With follow_ms > 0 the journal is polled indefinitely.
+static void cmd_ship(blockdev_t *dev, const char *out_path, uint32_t from, long follow_ms) {
+    int out = STDOUT_FILENO;
+    if (strcmp(out_path, "-") != 0) {
+        out = open(out_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (out < 0) die("open log");
+        uint32_t last = trim_stream(out, "ship");
+        if (from == UINT32_MAX) from = last;
+    }
+    if (from == UINT32_MAX) from = 0;
+
+    unsigned char *jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
+    ship_ctx_t sc = { .buf = (unsigned char *)malloc(JOURNAL_BYTES) };
+    if (!jbuf || !sc.buf) die("malloc ship");
+
+    for (;;) {
+        struct superblock sb;
+        load_journal_stable(dev, jbuf, &sb);
+
+        sc.len = 0;
+        sc.after = from;
+        sc.prev = sb.checkpoint_seq;
+        sc.first_seq = 0;
+        if (!(sb.state & FS_STATE_CLEAN)) journal_scan(jbuf, ship_txn, &sc);
+
+        // Transactions installed before they were shipped are gone from the journal.
+        uint32_t next = sc.first_seq ? sc.first_seq : sb.checkpoint_seq + 1;
+        if (next > from + 1) {
+            fprintf(stderr, "ship: seq %u..%u already checkpointed; reseed the replica from a snapshot\n",
+                    from + 1, next - 1);
+            exit(1);
+        }
+        if (sc.len > 0) {
+            write_all(out, sc.buf, sc.len);
+            if (out != STDOUT_FILENO && fsync(out) != 0) die("fsync log");
+            fprintf(stderr, "ship: sent seq %u..%u\n", sc.first_seq, sc.last_seq);
+            from = sc.last_seq;
+        }
+        if (follow_ms <= 0) break;
+        metrics_tick();
+        usleep((useconds_t)follow_ms * 1000U);
+    }
+
+    if (sc.len == 0 && follow_ms <= 0) fprintf(stderr, "ship: nothing newer than seq %u\n", from);
+    if (out != STDOUT_FILENO) close(out);
+    free(sc.buf);
+    free(jbuf);
+}
+
+static void report_lag(const char *tag, uint32_t replica_seq, blockdev_t *primary) {
+    if (!primary) {
+        printf("%s: image at seq %u\n", tag, replica_seq);
+    } else {
+        uint32_t primary_seq = newest_seq(primary);
+        printf("%s: replica at seq %u, primary at seq %u, lag %u transaction(s)\n", tag, replica_seq, primary_seq,
+               primary_seq > replica_seq ? primary_seq - replica_seq : 0);
+    }
+    fflush(stdout);
+}
+
+// True if input arrives within ms.
+static int input_ready(int in, uint32_t ms) {
+    struct pollfd pfd = { .fd = in, .events = POLLIN };
+    return poll(&pfd, 1, (int)ms) != 0;
+}
+
+// The replica's journal during apply: transactions are appended in memory
+// and flushed in groups, one sync pair per group.
+typedef struct {
+    blockdev_t *dev;
+    unsigned char *jbuf;
+    uint32_t flushed;   // journal bytes on disk
+    uint32_t last_seq;  // newest appended
+    uint32_t pending;   // transactions journaled since the last install
+    double flush_secs;  // running averages
+    double gap_secs;
+    double absorption;
+    uint64_t last_arrival;
+    uint32_t txns;                   // appended so far
+    uint32_t written[TOTAL_BLOCKS];  // txns when each block was last appended
+} apply_journal_t;
+
+static void apply_flush(apply_journal_t *aj) {
+    journal_header_t *jh = (journal_header_t *)aj->jbuf;
+    if (jh->nbytes == aj->flushed) return;
+    struct superblock sb;
+    read_superblock(aj->dev, &sb);
+    mark_dirty(aj->dev, &sb);
+    uint64_t start = now_ns();
+    flush_journal_append(aj->dev, aj->jbuf, aj->flushed, jh->nbytes);
+    aj->flush_secs = ewma(aj->flush_secs, (double)(now_ns() - start) / 1e9);
+    VSFS_PROBE2(txn_commit, aj->last_seq, jh->nbytes);
+    metrics_set(G_JOURNAL_BYTES, jh->nbytes);
+    aj->flushed = jh->nbytes;
+}
+
+static void apply_install(apply_journal_t *aj) {
+    apply_flush(aj);
+    install_journal(aj->dev, NULL);
+    load_journal(aj->dev, aj->jbuf);
+    aj->flushed = ((journal_header_t *)aj->jbuf)->nbytes;
+    aj->pending = 0;
+}
+
+static void apply_workload(apply_journal_t *aj, workload_t *w) {
+    journal_workload(aj->jbuf, w);
+    w->flush_secs = aj->flush_secs;
+    if (aj->gap_secs > 0) w->rate = 1.0 / aj->gap_secs;
+}
+
+// Absorption as the largest batch would see it: the share of a transaction's
+// blocks logged again within that many transactions. The journal alone
+// cannot tell, as it holds only the current batch.
+static void apply_absorb(apply_journal_t *aj, const stream_txn_t *t, uint32_t window) {
+    uint32_t again = 0;
+    aj->txns++;
+    for (int i = 0; i < t->cnt; i++) {
+        uint32_t b = t->block_no[i];
+        if (b >= TOTAL_BLOCKS) continue;
+        if (aj->written[b] && aj->txns - aj->written[b] <= window) again++;
+        aj->written[b] = aj->txns;
+    }
+    if (t->cnt > 0) aj->absorption = ewma(aj->absorption, (double)again / t->cnt);
+}
+
+// Keeps room for `needed` more journal bytes. Compaction needs room to stage
+// the folded transaction, so it is done as soon as the next transaction
+// would take that away, provided it frees enough; otherwise the journal is
+// installed once full.
+static void apply_make_room(apply_journal_t *aj, const char *tag, uint32_t needed) {
+    journal_header_t *jh = (journal_header_t *)aj->jbuf;
+    if (jh->nbytes + needed <= JOURNAL_BYTES / 2) return;
+    const tune_conf_t *conf = tune_conf();
+    workload_t w;
+    char what[128];
+    apply_workload(aj, &w);
+    int full = jh->nbytes + needed > JOURNAL_BYTES;
+    if (!full && jh->nbytes + needed + w.folded <= JOURNAL_BYTES) return;
+    if (tune_compacts(conf, &w, needed)) {
+        uint32_t end = jh->nbytes, freed;
+        apply_flush(aj);
+        int folded = compact_journal(aj->dev, &freed);
+        if (folded > 0) {
+            load_journal(aj->dev, aj->jbuf);
+            aj->flushed = jh->nbytes;
+            snprintf(what, sizeof(what), "journal %u/%u byte(s): compacted %d, freed %u", end, JOURNAL_BYTES,
+                     folded, freed);
+            tune_log(tag, &w, what);
+            return;
+        }
+    }
+    if (!full) return;
+    VSFS_PROBE2(journal_full, jh->nbytes, needed);
+    metrics_count(M_JOURNAL_FULL, 1);
+    apply_install(aj);
+    tune_log(tag, &w, "journal full: installed");
+}
+
+// Replays a log stream into this image through its own journal, so a crash
+// of the replica is recovered like any other: transactions are appended with
+// their original sequence numbers, flushed in groups and installed in
+// batches (see tuning). Replay stops before the first transaction past
+// until_seq or committed after until_time, and fails if that point is
+// behind the image, inside a compacted transaction or past the stream.
+// Returns nonzero if the image did not reach the intended point.
+static int cmd_apply(blockdev_t *dev, const char *tag, const char *in_path, const char *primary_path,
+                      uint32_t until_seq, uint32_t until_time) {
+    int in = STDIN_FILENO;
+    if (strcmp(in_path, "-") != 0) {
+        in = open(in_path, O_RDONLY);
+        if (in < 0) die("open log");
+    }
+    blockdev_t *primary = NULL;
+    if (primary_path) {
+        primary = bdev_open(primary_path, BDEV_RDONLY, 0);
+        if (!primary) die("open primary");
+    }
+
+    // Start from a fully installed replica.
+    install_journal(dev, NULL);
+    struct superblock sb;
+    read_superblock(dev, &sb);
+    uint32_t cur = sb.checkpoint_seq;
+    if (until_seq < cur) {
+        fprintf(stderr, "%s: image is already at seq %u, past seq %u\n", tag, cur, until_seq);
+        bdev_close(primary);
+        if (in != STDIN_FILENO) close(in);
+        return 1;
+    }
+
+    apply_journal_t aj = { .dev = dev, .jbuf = (unsigned char *)malloc(JOURNAL_BYTES) };
+    stream_txn_t t;
+    t.imgs = (unsigned char *)malloc((size_t)MAX_PENDING * BLOCK_SIZE);
+    if (!aj.jbuf || !t.imgs) die("malloc apply");
+    load_journal(dev, aj.jbuf);
+    journal_init_if_needed(aj.jbuf);
+    journal_header_t *jh = (journal_header_t *)aj.jbuf;
+    aj.flushed = jh->nbytes;
+
+    const tune_conf_t *conf = tune_conf();
+    tune_t tn = { conf->window_ms.lo, conf->headroom.lo, conf->batch.hi };
+    int applied = 0, failed = 0;
+    for (;;) {
+        metrics_tick();
+        if (jh->nbytes > aj.flushed && !input_ready(in, tn.window_ms)) {
+            apply_flush(&aj);
+            workload_t w;
+            apply_workload(&aj, &w);
+            w.absorption = aj.absorption;
+            tune_t was = tn;
+            tune(conf, &w, &tn);
+            if (tn.window_ms != was.window_ms || tn.batch != was.batch) {
+                char what[128];
+                snprintf(what, sizeof(what), "window %ums, batch %u txn(s)", tn.window_ms, tn.batch);
+                tune_log(tag, &w, what);
+            }
+            if (aj.pending >= tn.batch) {
+                apply_install(&aj);
+                report_lag(tag, cur, primary);
+            }
+        }
+        if (aj.pending > 0 && jh->nbytes == aj.flushed && !input_ready(in, APPLY_IDLE_MS)) {
+            apply_install(&aj);
+            report_lag(tag, cur, primary);
+        }
+        int got = read_stream_txn(in, &t);
+        if (got < 0) {
+            fprintf(stderr, "%s: damaged log stream after seq %u\n", tag, cur);
+            failed = 1;
+        }
+        if (got <= 0) break;
+        uint64_t now = now_ns();
+        if (aj.last_arrival) aj.gap_secs = ewma(aj.gap_secs, (double)(now - aj.last_arrival) / 1e9);
+        aj.last_arrival = now;
+        if (t.seq <= cur) continue;
+        if (t.seq > until_seq || t.time > until_time) {
+            // Folded commits have no images of their own to stop at, and
+            // the span's commit times are gone; only its ends are reachable.
+            // Stopping on seq, the point is missed unless the image is at it
+            // already. Stopping on time, it is missed if the transaction
+            // folds commits the image lacks, whose times may be earlier.
+            int inside_span;
+            if (t.seq > until_seq) {
+                inside_span = until_seq > cur;
+            } else {
+                int folded = t.first < t.seq;
+                int folds_new = t.seq > cur + 1;
+                inside_span = folded && folds_new;
+            }
+            if (t.first > cur + 1) {
+                fprintf(stderr, "%s: stream jumps from seq %u to %u\n", tag, cur, t.first);
+                failed = 1;
+            } else if (inside_span) {
+                fprintf(stderr, "%s: stop point is inside compacted seq %u..%u; nearest reachable are seq %u and %u\n",
+                        tag, t.first, t.seq, cur, t.seq);
+                failed = 1;
+            }
+            break;
+        }
+        if (t.first > cur + 1) {
+            fprintf(stderr, "%s: stream jumps from seq %u to %u\n", tag, cur, t.first);
+            failed = 1;
+            break;
+        }
+
+        uint32_t needed = (uint32_t)t.cnt * (uint32_t)DATA_REC_SIZE + (uint32_t)COMMIT_REC_SIZE;
+        if (sizeof(journal_header_t) + needed > JOURNAL_BYTES) {
+            fprintf(stderr, "%s: transaction %u does not fit in the journal\n", tag, t.seq);
+            failed = 1;
+            break;
+        }
+        apply_make_room(&aj, tag, needed);
+
+        VSFS_PROBE1(txn_begin, t.seq);
+        uint32_t off = jh->nbytes;
+        for (int i = 0; i < t.cnt; i++) {
+            journal_append_data(aj.jbuf, &off, t.block_no[i], t.imgs + (size_t)i * BLOCK_SIZE);
+        }
+        journal_append_commit(aj.jbuf, &off, t.seq, t.time);
+        jh->nbytes = off;
+        metrics_count(M_COMMITS, 1);
+        metrics_observe(H_TXN_RECORDS, t.cnt);
+
+        apply_absorb(&aj, &t, conf->batch.hi);
+        aj.last_seq = t.seq;
+        aj.pending++;
+        cur = t.seq;
+        applied++;
+    }
+
+    apply_install(&aj);
+    printf("%s: applied %d transaction(s)\n", tag, applied);
+    report_lag(tag, cur, primary);
+
+    bdev_close(primary);
+    if (in != STDIN_FILENO) close(in);
+    free(t.imgs);
+    free(aj.jbuf);
+    if (!failed && until_seq != UINT32_MAX && cur < until_seq) {
+        fprintf(stderr, "%s: stream ends at seq %u, before seq %u\n", tag, cur, until_seq);
+        failed = 1;
+    }
+    return failed;
+}
+
+/* -------------------- stat -------------------- */
+// Reads blocks as of the newest published commit without taking a turn:
+// from the control block's cache, else through the journal like snapshot,
+// retrying if an install moves install_gen underneath.
+static void read_published(blockdev_t *dev, uint32_t n, const uint32_t *block_no, unsigned char *const *bufs) {
+    if (ctl && jctl_cache_read(ctl, n, block_no, bufs)) {
+        metrics_count(M_CACHE_HITS, 1);
+        return;
+    }
+    metrics_count(M_CACHE_MISSES, 1);
+
+    unsigned char *jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
+    if (!jbuf) die("malloc journal");
+    static overlay_t ov;
+    for (int attempt = 1; attempt <= SNAPSHOT_RETRIES; attempt++) {
+        struct superblock sb, sb_after;
+        read_superblock(dev, &sb);
+        if (sb.install_gen & 1U) {
+            usleep(1000);
+            continue;
+        }
+        memset(&ov, 0, sizeof(ov));
+        if (!(sb.state & FS_STATE_CLEAN)) {
+            load_journal(dev, jbuf);
+            journal_init_if_needed(jbuf);
+            overlay_build(&ov, jbuf, UINT32_MAX);
+        }
+        for (uint32_t i = 0; i < n; i++) overlay_read(dev, &ov, block_no[i], bufs[i]);
+        read_superblock(dev, &sb_after);
+        if (sb_after.install_gen == sb.install_gen) {
+            free(jbuf);
+            return;
+        }
+    }
+    fprintf(stderr, "stat: install in progress or interrupted (run ./journal install); giving up\n");
+    exit(1);
+}
+
+// Looks `name` up in the root directory and prints its inode.
+static void cmd_stat(blockdev_t *dev, const char *name) {
+    uint8_t itbl0[BLOCK_SIZE], itbl1[BLOCK_SIZE], dirblk[BLOCK_SIZE];
+    uint32_t block_no[3] = { INODE_TABLE_BLK + 0, INODE_TABLE_BLK + 1, 0 };
+    unsigned char *bufs[3] = { itbl0, itbl1, dirblk };
+
+    // The root inode names the directory block; read it with the inode
+    // table, all as of one commit, until the two agree.
+    read_published(dev, 1, block_no, bufs);
+    for (;;) {
+        block_no[2] = ((const struct inode *)itbl0)[0].direct[0];
+        if (block_no[2] == 0 || block_no[2] >= TOTAL_BLOCKS) {
+            fprintf(stderr, "stat: root directory has no data block\n");
+            exit(1);
+        }
+        read_published(dev, 3, block_no, bufs);
+        if (((const struct inode *)itbl0)[0].direct[0] == block_no[2]) break;
+    }
+
+    const struct inode *root = &((const struct inode *)itbl0)[0];
+    const struct dirent *des = (const struct dirent *)dirblk;
+    uint32_t entries = root->size / sizeof(struct dirent);
+    for (uint32_t i = 0; i < entries && i < DIRENTS_PER_BLOCK; i++) {
+        if (des[i].inode == 0 || strncmp(des[i].name, name, sizeof(des[i].name)) != 0) continue;
+        uint32_t ino = des[i].inode;
+        if (ino >= INODE_COUNT) break;
+        const struct inode *in = ino < INODES_PER_BLOCK ? &((const struct inode *)itbl0)[ino]
+                                                        : &((const struct inode *)itbl1)[ino - INODES_PER_BLOCK];
+        printf("stat: '%s' is inode %u: %s, %u link(s), %u byte(s), ctime %u, mtime %u\n", name, ino,
+               in->type == 2 ? "directory" : in->type == 1 ? "file" : "free", in->links, in->size, in->ctime,
+               in->mtime);
+        return;
+    }
+    fprintf(stderr, "stat: no such file '%s'\n", name);
+    exit(1);
+}
+
+/* -------------------- dump -------------------- */
+// Decodes each committed transaction against the contents its blocks
+// replace: the home location, or an earlier transaction still in the journal.
+typedef struct {
+    blockdev_t *dev;
+    int json;
+    overlay_t ov;       // versions as of the transaction being dumped
+    int txns;
+    uint32_t prev;      // seq of the previous transaction
+    uint64_t logged;    // journal bytes spent on committed transactions
+    uint64_t changed;   // bytes that actually differ from the prior version
+    int first_change;
+} dump_ctx_t;
+
+static void json_string(const char *str, size_t max) {
+    putchar('"');
+    for (size_t i = 0; i < max && str[i]; i++) {
+        unsigned char c = (unsigned char)str[i];
+        if (c == '"' || c == '\\') printf("\\%c", c);
+        else if (c < 0x20 || c >= 0x7f) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+}
+
+static void dump_change(dump_ctx_t *dc, const char *kind, uint32_t index, const char *field, uint32_t old_v,
+                        uint32_t new_v) {
+    if (old_v == new_v) return;
+    if (dc->json) {
+        printf("%s{\"kind\":\"%s\",\"index\":%u,\"field\":\"%s\",\"old\":%u,\"new\":%u}",
+               dc->first_change ? "" : ",", kind, index, field, old_v, new_v);
+    } else {
+        printf("      %s %u %s: %u -> %u\n", kind, index, field, old_v, new_v);
+    }
+    dc->first_change = 0;
+}
+
+static void dump_dirent(dump_ctx_t *dc, uint32_t index, const struct dirent *o, const struct dirent *n) {
+    if (dc->json) {
+        printf("%s{\"kind\":\"dirent\",\"index\":%u,\"old\":{\"inode\":%u,\"name\":", dc->first_change ? "" : ",",
+               index, o->inode);
+        json_string(o->name, sizeof(o->name));
+        printf("},\"new\":{\"inode\":%u,\"name\":", n->inode);
+        json_string(n->name, sizeof(n->name));
+        printf("}}");
+    } else {
+        printf("      dirent %u: '%.*s' -> inode %u  =>  '%.*s' -> inode %u\n", index, (int)sizeof(o->name),
+               o->name, o->inode, (int)sizeof(n->name), n->name, n->inode);
+    }
+    dc->first_change = 0;
+}
+
+static const char *region_name(uint32_t blk) {
+    if (blk == SUPERBLOCK_BLK) return "superblock";
+    if (blk < INODE_BITMAP_BLK) return "journal";
+    if (blk == INODE_BITMAP_BLK) return "inode bitmap";
+    if (blk == DATA_BITMAP_BLK) return "data bitmap";
+    if (blk < DATA_START_BLK) return "inode table";
+    return "data";
+}
+
+static void dump_block(dump_ctx_t *dc, uint32_t blk, const unsigned char *old, const unsigned char *img) {
+    if (blk == INODE_BITMAP_BLK || blk == DATA_BITMAP_BLK) {
+        const char *kind = blk == INODE_BITMAP_BLK ? "inode" : "data_block";
+        for (uint32_t bit = 0; bit < BLOCK_SIZE * 8; bit++) {
+            uint32_t index = blk == INODE_BITMAP_BLK ? bit : DATA_START_BLK + bit;
+            dump_change(dc, kind, index, "allocated", (uint32_t)bitmap_test(old, bit), (uint32_t)bitmap_test(img, bit));
+        }
+    } else if (blk >= INODE_TABLE_BLK && blk < DATA_START_BLK) {
+        const struct inode *o = (const struct inode *)old;
+        const struct inode *n = (const struct inode *)img;
+        for (uint32_t k = 0; k < INODES_PER_BLOCK; k++) {
+            uint32_t inum = (blk - INODE_TABLE_BLK) * INODES_PER_BLOCK + k;
+            dump_change(dc, "inode", inum, "type", o[k].type, n[k].type);
+            dump_change(dc, "inode", inum, "links", o[k].links, n[k].links);
+            dump_change(dc, "inode", inum, "size", o[k].size, n[k].size);
+            for (uint32_t d = 0; d < DIRECT_POINTERS; d++) {
+                static const char *names[DIRECT_POINTERS] = { "direct[0]", "direct[1]", "direct[2]", "direct[3]",
+                                                               "direct[4]", "direct[5]", "direct[6]", "direct[7]" };
+                dump_change(dc, "inode", inum, names[d], o[k].direct[d], n[k].direct[d]);
+            }
+            dump_change(dc, "inode", inum, "ctime", o[k].ctime, n[k].ctime);
+            dump_change(dc, "inode", inum, "mtime", o[k].mtime, n[k].mtime);
+        }
+    } else if (blk >= DATA_START_BLK) {
+        // Only directory blocks are ever journaled.
+        const struct dirent *o = (const struct dirent *)old;
+        const struct dirent *n = (const struct dirent *)img;
+        for (uint32_t e = 0; e < BLOCK_SIZE / sizeof(struct dirent); e++) {
+            if (memcmp(&o[e], &n[e], sizeof(struct dirent)) != 0) dump_dirent(dc, e, &o[e], &n[e]);
+        }
+    }
+}
+
+static void dump_txn(const commit_rec_t *cr, const pending_t *recs, int cnt, void *arg) {
+    dump_ctx_t *dc = (dump_ctx_t *)arg;
+    uint32_t logged = (uint32_t)cnt * (uint32_t)DATA_REC_SIZE + (uint32_t)COMMIT_REC_SIZE;
+    uint32_t changed = 0;
+    unsigned char old[BLOCK_SIZE];
+    uint32_t first = dc->prev + 1; // earlier when compacted
+    dc->prev = cr->seq;
+
+    if (dc->json) {
+        printf("%s{\"seq\":%u,\"first_seq\":%u,\"time\":%u,\"records\":%d,\"bytes\":%u,\"blocks\":[",
+               dc->txns ? "," : "", cr->seq, first, cr->time, cnt, logged);
+    } else {
+        time_t t = (time_t)cr->time;
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        printf("txn seq %u at %s: %d block(s), %u byte(s) logged", cr->seq, when, cnt, logged);
+        if (first != cr->seq) printf(", compacted from seq %u..%u", first, cr->seq);
+        putchar('\n');
+    }
+
+    for (int i = 0; i < cnt; i++) {
+        uint32_t blk = recs[i].block_no;
+        overlay_read(dc->dev, &dc->ov, blk, old);
+        uint32_t diff = 0;
+        for (uint32_t b = 0; b < BLOCK_SIZE; b++) diff += old[b] != recs[i].block_img[b];
+        changed += diff;
+
+        dc->first_change = 1;
+        if (dc->json) {
+            printf("%s{\"block\":%u,\"region\":\"%s\",\"changed_bytes\":%u,\"changes\":[", i ? "," : "", blk,
+                   region_name(blk), diff);
+        } else {
+            printf("    block %u (%s): %u byte(s) changed\n", blk, region_name(blk), diff);
+        }
+        dump_block(dc, blk, old, recs[i].block_img);
+        if (dc->json) printf("]}");
+    }
+    if (dc->json) printf("],\"changed_bytes\":%u}", changed);
+
+    overlay_add_txn(cr, recs, cnt, &dc->ov);
+    dc->txns++;
+    dc->logged += logged;
+    dc->changed += changed;
+}
+
+static void cmd_dump(blockdev_t *dev, int json) {
+    unsigned char *jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
+    dump_ctx_t *dc = (dump_ctx_t *)calloc(1, sizeof(*dc));
+    if (!jbuf || !dc) die("malloc dump");
+
+    struct superblock sb;
+    load_journal_stable(dev, jbuf, &sb);
+    journal_header_t *jh = (journal_header_t *)jbuf;
+    dc->dev = dev;
+    dc->json = json;
+    dc->ov.max_seq = UINT32_MAX;
+    dc->prev = sb.checkpoint_seq;
+    const rec_header_t *pad = (const rec_header_t *)(jbuf + sizeof(journal_header_t));
+    uint32_t skipped = pad->type == REC_PAD && pad->size <= JOURNAL_BYTES ? pad->size : 0; // left by compaction
+
+    if (json) printf("{\"checkpoint_seq\":%u,\"clean\":%s,\"transactions\":[", sb.checkpoint_seq,
+                     (sb.state & FS_STATE_CLEAN) ? "true" : "false");
+    if (!(sb.state & FS_STATE_CLEAN)) journal_scan(jbuf, dump_txn, dc);
+
+    uint32_t used = jh->nbytes - (uint32_t)sizeof(journal_header_t);
+    double amp = dc->changed ? (double)dc->logged / (double)dc->changed : 0.0;
+    if (json) {
+        printf("],\"journal_bytes\":%u,\"journal_capacity\":%u,\"logged_bytes\":%llu,\"changed_bytes\":%llu,"
+               "\"write_amplification\":%.2f}\n",
+               used, (uint32_t)(JOURNAL_BYTES - sizeof(journal_header_t)), (unsigned long long)dc->logged,
+               (unsigned long long)dc->changed, amp);
+    } else {
+        printf("%d committed transaction(s) after checkpoint seq %u; journal %u/%u byte(s) used\n", dc->txns,
+               sb.checkpoint_seq, used, (uint32_t)(JOURNAL_BYTES - sizeof(journal_header_t)));
+        if (dc->txns > 0 && used > dc->logged + skipped) {
+            printf("%llu byte(s) of uncommitted records at the tail\n",
+                   (unsigned long long)(used - dc->logged - skipped));
+        }
+        printf("logged %llu byte(s) for %llu changed byte(s): write amplification %.1fx\n",
+               (unsigned long long)dc->logged, (unsigned long long)dc->changed, amp);
+    }
+
+    free(dc);
+    free(jbuf);
+}
+
+/* -------------------- create -------------------- */
+
+// Control block items a create writes and validates.
+#define ITEM_INODE(i)  (i)                 // inode bitmap bit and inode slot
+#define ITEM_DIRENT(e) (INODE_COUNT + (e)) // root directory entry
+_Static_assert(INODE_COUNT + DIRENTS_PER_BLOCK <= JCTL_ITEMS, "control block has too few items");
+
+// Metadata as a create sees it: the journal up to `end`, overlaid on the
+// home locations.
+typedef struct {
+    unsigned char *jbuf;
+    overlay_t ov;
+    struct superblock sb;
+    uint32_t end;
+} create_view_t;
+
+static void view_overlay(create_view_t *v) {
+    journal_header_t *jh = (journal_header_t *)v->jbuf;
+    jh->magic = JOURNAL_MAGIC;
+    jh->nbytes = v->end;
+    // A clean image has nothing in the journal, so home locations are current.
+    memset(&v->ov, 0, sizeof(v->ov));
+    if (!(v->sb.state & FS_STATE_CLEAN)) overlay_build(&v->ov, v->jbuf, UINT32_MAX);
+}
+
+// With a control block, `end` comes from it: every record below it has been
+// written by an earlier ticket, published or not. Without one, the on-disk
+// header says where the journal ends.
+static void view_load(blockdev_t *dev, create_view_t *v, uint32_t end) {
+    read_superblock(dev, &v->sb);
+    load_journal(dev, v->jbuf);
+    if (!ctl) {
+        journal_init_if_needed(v->jbuf);
+        end = ((journal_header_t *)v->jbuf)->nbytes;
+    }
+    v->end = end < sizeof(journal_header_t) ? (uint32_t)sizeof(journal_header_t) : end;
+    view_overlay(v);
+}
+
+// Moves the view forward to `end`, rereading only the journal blocks that
+// later builds wrote.
+static void view_extend(blockdev_t *dev, create_view_t *v, uint32_t end) {
+    read_superblock(dev, &v->sb);
+    for (uint32_t i = v->end / BLOCK_SIZE; i * BLOCK_SIZE < end; i++) {
+        read_block(dev, JOURNAL_START_BLK + i, v->jbuf + i * BLOCK_SIZE);
+    }
+    v->end = end;
+    view_overlay(v);
+}
+
+// What a create decided from a view: the inode it allocates and how many
+// root directory entries it checked the name against. Appending the entry
+// and updating the root inode commute with other creates, so they are done
+// against the newest metadata at commit time.
+typedef struct {
+    int ino;
+    uint32_t entries;
+    uint64_t snap; // control block position of the view
+} create_plan_t;
+
+// Returns NULL, or why the create is refused.
+static const char *plan_create(blockdev_t *dev, const create_view_t *v, const char *name, uint32_t t,
+                               create_plan_t *plan) {
+    uint8_t inode_bm[BLOCK_SIZE], itbl0[BLOCK_SIZE], dirblk[BLOCK_SIZE];
+    overlay_read(dev, &v->ov, INODE_BITMAP_BLK, inode_bm);
+
+    // Find a free inode (skip 0, root), passing over those claimed by other
+    // creates in flight unless nothing else is free, and those allocated
+    // since the view.
+    int first_free = -1;
+    plan->ino = -1;
+    for (uint32_t i = 1; i < INODE_COUNT; i++) {
+        if (bitmap_test(inode_bm, i)) continue;
+        if (ctl && jctl_version(ctl, ITEM_INODE(i)) > plan->snap) continue;
+        if (first_free < 0) first_free = (int)i;
+        if (!ctl || jctl_claim(ctl, ITEM_INODE(i), t)) {
+            plan->ino = (int)i;
+            break;
+        }
+    }
+    if (plan->ino < 0) plan->ino = first_free;
+    if (plan->ino < 0) return "no free inode available";
+
+    // Root inode is inode 0
+    overlay_read(dev, &v->ov, INODE_TABLE_BLK + 0, itbl0);
+    const struct inode *root = &((const struct inode *)itbl0)[0];
+    if (root->type != 2) return "root inode is not a directory";
+    if (root->direct[0] == 0) return "root directory has no data block";
 
     // Check name not already present within current size
-    uint32_t used_entries = root.size / sizeof(struct dirent);
-    for (uint32_t i = 0; i < used_entries; i++) {
+    overlay_read(dev, &v->ov, root->direct[0], dirblk);
+    const struct dirent *des = (const struct dirent *)dirblk;
+    plan->entries = root->size / sizeof(struct dirent);
+    for (uint32_t i = 0; i < plan->entries; i++) {
         if (des[i].inode != 0 && strncmp(des[i].name, name, sizeof(des[i].name)) == 0) {
-            fprintf(stderr, "create: file already exists\n");
-            exit(1);
+            return "file already exists";
         }
     }
+    if (root->size + sizeof(struct dirent) > BLOCK_SIZE) {
+        return "root directory is full (needs new data block; not implemented)";
+    }
+    return NULL;
+}
 
-    // Append new entry at the end of directory "used region"
-    if (root.size + sizeof(struct dirent) > BLOCK_SIZE) {
-        fprintf(stderr, "create: root directory is full (needs new data block; not implemented)\n");
-        exit(1);
+// True if nothing the plan read has changed since its view: no later build
+// wrote the inode or an entry the name was checked against, and no entry
+// appended since carries the same name. An install in between changes none.
+static int plan_valid(blockdev_t *dev, const create_view_t *v, const char *name, const create_plan_t *plan) {
+    if (!ctl) return 1;
+    if (jctl_version(ctl, ITEM_INODE(plan->ino)) > plan->snap) return 0;
+    for (uint32_t i = 0; i < plan->entries; i++) {
+        if (jctl_version(ctl, ITEM_DIRENT(i)) > plan->snap) return 0;
+    }
+    uint8_t itbl0[BLOCK_SIZE], dirblk[BLOCK_SIZE];
+    overlay_read(dev, &v->ov, INODE_TABLE_BLK + 0, itbl0);
+    const struct inode *root = &((const struct inode *)itbl0)[0];
+    overlay_read(dev, &v->ov, root->direct[0], dirblk);
+    const struct dirent *des = (const struct dirent *)dirblk;
+    for (uint32_t i = plan->entries; i < root->size / sizeof(struct dirent); i++) {
+        if (des[i].inode != 0 && strncmp(des[i].name, name, sizeof(des[i].name)) == 0) return 0;
+    }
+    return 1;
+}
+
+#define CREATE_FULL         (-2)
+#define CREATE_FULL_RETRIES 3
+#define CREATE_MAX_BYTES    (4U * DATA_REC_SIZE + COMMIT_REC_SIZE) // bitmap, 2 inode blocks, dir
+
+// Journals the creation of `name` in the root directory. The create is
+// planned without holding any turn; in its build turn it is validated and
+// planned again only if a concurrent commit invalidated it, then the records
+// are written, unsynced, and left in *span. Returns the new inode number and
+// its transaction's sequence number, CREATE_FULL if the journal has no room
+// for it, or -1 after printing why the create was refused.
+static int create_txn(blockdev_t *dev, uint32_t t, const char *name, uint32_t *seq_out, txn_span_t *span) {
+    // Basic filename rules: must fit in dirent.name (28 incl null)
+    if (!name || name[0] == '\0') {
+        fprintf(stderr, "create: empty name not allowed\n");
+        return -1;
+    }
+    if (strlen(name) >= 28) {
+        fprintf(stderr, "create: name too long (max 27 chars)\n");
+        return -1;
+    }
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        fprintf(stderr, "create: invalid name\n");
+        return -1;
     }
 
-    uint32_t new_entry_idx = used_entries;
+    static create_view_t v;
+    v.jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
+    if (!v.jbuf) die("malloc journal");
+
+    create_plan_t plan = { .snap = ctl ? jctl_snapshot(ctl) : 0 };
+    view_load(dev, &v, (uint32_t)plan.snap);
+    const char *refused = plan_create(dev, &v, name, t, &plan);
+    // An install or compaction moves journal and home blocks under a view
+    // read without a turn, which validation cannot tell from a consistent one.
+    struct superblock sb_after;
+    read_superblock(dev, &sb_after);
+    int torn = (v.sb.install_gen & 1U) || sb_after.install_gen != v.sb.install_gen;
+
+    txn_wait_build(dev, t);
+    if (ctl) {
+        if (jctl_current(ctl, plan.snap)) {
+            view_extend(dev, &v, jctl_tail(ctl));
+        } else {
+            view_load(dev, &v, jctl_tail(ctl));
+        }
+        int conflict = !refused && (torn || !plan_valid(dev, &v, name, &plan));
+        if (conflict) {
+            VSFS_PROBE1(txn_conflict, (uint32_t)plan.ino);
+            metrics_count(M_TXN_CONFLICTS, 1);
+        }
+        // A refusal may be stale too. Nothing else can build now, so the
+        // second plan, against everything built so far, stands.
+        if (refused || conflict) {
+            plan.snap = jctl_snapshot(ctl);
+            refused = plan_create(dev, &v, name, t, &plan);
+        }
+    }
+    if (refused) {
+        fprintf(stderr, "create: %s\n", refused);
+        free(v.jbuf);
+        return -1;
+    }
+    int new_ino = plan.ino;
+    metrics_observe(H_INODE_SCAN, (uint32_t)new_ino);
+
+    struct superblock sb = v.sb;
+    uint32_t seq = (v.ov.last_seq > sb.checkpoint_seq ? v.ov.last_seq : sb.checkpoint_seq) + 1;
+    VSFS_PROBE1(txn_begin, seq);
+
+    // Read the newest inode bitmap, inode table and root directory blocks
+    uint8_t inode_bm[BLOCK_SIZE], itbl0[BLOCK_SIZE], itbl1[BLOCK_SIZE], dirblk[BLOCK_SIZE];
+    overlay_read(dev, &v.ov, INODE_BITMAP_BLK, inode_bm);
+    overlay_read(dev, &v.ov, INODE_TABLE_BLK + 0, itbl0);
+    overlay_read(dev, &v.ov, INODE_TABLE_BLK + 1, itbl1);
+
+    struct inode *inodes0 = (struct inode *)itbl0;
+    struct inode *inodes1 = (struct inode *)itbl1;
+    struct inode root = inodes0[0];
+    uint32_t root_dir_blk = root.direct[0];
+    overlay_read(dev, &v.ov, root_dir_blk, dirblk);
+    struct dirent *des = (struct dirent *)dirblk;
+
+    // Append new entry at the end of directory "used region"
+    uint32_t new_entry_idx = root.size / sizeof(struct dirent);
     memset(&des[new_entry_idx], 0, sizeof(struct dirent));
     des[new_entry_idx].inode = (uint32_t)new_ino;
     strncpy(des[new_entry_idx].name, name, sizeof(des[new_entry_idx].name) - 1);
@@ -312,13 +2008,8 @@ static void cmd_create(int fd, const char *name) {
     bitmap_set(inode_bm, (uint32_t)new_ino);
 
     // ---------------- journal append (inode bitmap + inode table block(s) + root dir block) ----------------
-    unsigned char *jbuf = (unsigned char *)malloc(JOURNAL_BYTES);
-    if (!jbuf) die("malloc journal");
-    load_journal(fd, jbuf);
-    journal_init_if_needed(jbuf);
-
+    unsigned char *jbuf = v.jbuf;
     journal_header_t *jh = (journal_header_t *)jbuf;
-    uint32_t off = jh->nbytes;
 
     // We will write these blocks:
     //  - inode bitmap block
@@ -332,10 +2023,16 @@ static void cmd_create(int fd, const char *name) {
     needed += DATA_REC_SIZE; // root dir block
     needed += COMMIT_REC_SIZE;
 
-    if (off + needed > JOURNAL_BYTES) {
+    uint32_t off;
+    if (journal_reserve(jh, needed, &off) != 0) {
+        VSFS_PROBE2(journal_full, jh->nbytes, needed);
+        metrics_count(M_JOURNAL_FULL, 1);
         free(jbuf);
-        fprintf(stderr, "create: journal is full; run ./journal install first\n");
-        exit(1);
+        return CREATE_FULL;
+    }
+    if (ctl) {
+        jctl_bump(ctl, ITEM_INODE((uint32_t)new_ino));
+        jctl_bump(ctl, ITEM_DIRENT(new_entry_idx));
     }
 
     journal_append_data(jbuf, &off, INODE_BITMAP_BLK, inode_bm);
@@ -344,37 +2041,338 @@ static void cmd_create(int fd, const char *name) {
         journal_append_data(jbuf, &off, INODE_TABLE_BLK + 1, itbl1);
     }
     journal_append_data(jbuf, &off, root_dir_blk, dirblk);
-    journal_append_commit(jbuf, &off);
+    journal_append_commit(jbuf, &off, seq, (uint32_t)now);
+
+    mark_dirty(dev, &sb);
 
-    jh->nbytes = off;
-    flush_journal(fd, jbuf);
+    span->start = jh->nbytes;
+    span->end = off;
+    write_journal_records(dev, jbuf, span->start, span->end);
     free(jbuf);
 
-    printf("create: logged creation of '%s' as inode %d (journaled, not installed yet)\n", name, new_ino);
+    // Every block a create reads, so the cache alone can serve lookups.
+    const uint32_t cached_no[] = { INODE_BITMAP_BLK, INODE_TABLE_BLK + 0, INODE_TABLE_BLK + 1, root_dir_blk };
+    const uint8_t *cached[] = { inode_bm, itbl0, itbl1, dirblk };
+    span->ncached = TXN_CACHED_BLOCKS;
+    for (uint32_t i = 0; i < TXN_CACHED_BLOCKS; i++) {
+        span->cached_no[i] = cached_no[i];
+        memcpy(span->cached[i], cached[i], BLOCK_SIZE);
+    }
+
+    *seq_out = seq;
+    return new_ino;
+}
+
+static int do_create(blockdev_t *dev, const char *name, uint32_t *seq_out) {
+    uint64_t start = now_ns();
+    static txn_span_t span;
+    int new_ino;
+    // With VSFS_COMPACT set, a full journal is checkpointed and the create
+    // retried; other writers may fill it again in between.
+    for (int attempt = 0;; attempt++) {
+        span.start = span.end = span.ncached = 0;
+        uint32_t t = txn_ticket();
+        new_ino = create_txn(dev, t, name, seq_out, &span);
+        txn_commit(dev, t, &span);
+        if (new_ino != CREATE_FULL) break;
+        if (attempt == CREATE_FULL_RETRIES || !auto_checkpoint(dev, 0, CREATE_MAX_BYTES)) {
+            fprintf(stderr, "create: journal is full; run ./journal install first\n");
+            break;
+        }
+    }
+    if (new_ino < 0) {
+        metrics_count(M_COMMIT_FAILURES, 1);
+    } else {
+        VSFS_PROBE2(txn_commit, *seq_out, span.end);
+        metrics_count(M_COMMITS, 1);
+        metrics_observe(H_TXN_RECORDS, (double)(span.end - span.start - COMMIT_REC_SIZE) / DATA_REC_SIZE);
+        metrics_set(G_JOURNAL_BYTES, span.end);
+        metrics_observe(H_COMMIT_SECONDS, (double)(now_ns() - start) / 1e9);
+        auto_checkpoint(dev, (double)(now_ns() - start) / 1e9, 0);
+    }
+    return new_ino;
+}
+
+static void cmd_create(blockdev_t *dev, const char *name) {
+    uint32_t seq;
+    uint64_t start = now_ns();
+    int new_ino = do_create(dev, name, &seq);
+    trace_op(TRACE_CREATE, new_ino < 0, name, start);
+    if (new_ino < 0) exit(1);
+    printf("create: logged creation of '%s' as inode %d, seq %u (journaled, not installed yet)\n", name, new_ino, seq);
+}
+
+/* -------------------- trace replay -------------------- */
+typedef struct {
+    uint64_t *lat_ns;
+    uint32_t n;
+} lat_set_t;
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_latency(const char *op, lat_set_t *ls) {
+    if (ls->n == 0) return;
+    qsort(ls->lat_ns, ls->n, sizeof(uint64_t), cmp_u64);
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < ls->n; i++) sum += ls->lat_ns[i];
+    printf("  %-8s %6u op(s)  mean %8.1fus  p50 %8.1fus  p99 %8.1fus  max %8.1fus\n", op, ls->n,
+           (double)sum / ls->n / 1e3, (double)ls->lat_ns[ls->n / 2] / 1e3,
+           (double)ls->lat_ns[(ls->n * 99) / 100] / 1e3, (double)ls->lat_ns[ls->n - 1] / 1e3);
+}
+
+// Re-executes a recorded trace against this image (normally a fresh mkfs),
+// either with the original inter-arrival gaps or back to back.
+static void cmd_run_trace(blockdev_t *dev, const char *path, int max_speed) {
+    int tfd = open(path, O_RDONLY);
+    if (tfd < 0) die("open trace");
+    off_t size = lseek(tfd, 0, SEEK_END);
+    if (size < (off_t)sizeof(trace_header_t)) {
+        fprintf(stderr, "run-trace: '%s' is not a trace\n", path);
+        exit(1);
+    }
+    unsigned char *buf = (unsigned char *)malloc((size_t)size);
+    if (!buf || pread(tfd, buf, (size_t)size, 0) != size) die("read trace");
+    close(tfd);
+    trace_header_t th;
+    memcpy(&th, buf, sizeof(th));
+    if (th.magic != TRACE_MAGIC) {
+        fprintf(stderr, "run-trace: '%s' is not a trace\n", path);
+        exit(1);
+    }
+    if (th.version != TRACE_VERSION) {
+        fprintf(stderr, "run-trace: '%s' is a version %u trace; this build reads version %u\n", path, th.version,
+                TRACE_VERSION);
+        exit(1);
+    }
+
+    size_t max_ops = (size_t)size / sizeof(trace_rec_t);
+    lat_set_t creates = { .lat_ns = (uint64_t *)malloc(max_ops * sizeof(uint64_t)) };
+    lat_set_t installs = { .lat_ns = (uint64_t *)malloc(max_ops * sizeof(uint64_t)) };
+    if (!creates.lat_ns || !installs.lat_ns) die("malloc latencies");
+
+    tracing_disabled = 1;
+    uint64_t first_ns = 0, replay_start = now_ns(), recorded_busy = 0;
+    uint32_t ops = 0, mismatches = 0;
+    char name[256];
+
+    for (size_t off = sizeof(th); off + sizeof(trace_rec_t) <= (size_t)size;) {
+        trace_rec_t tr;
+        memcpy(&tr, buf + off, sizeof(tr));
+        off += sizeof(tr);
+        if (off + tr.name_len > (size_t)size) break;
+        memcpy(name, buf + off, tr.name_len);
+        name[tr.name_len] = '\0';
+        off += tr.name_len;
+
+        if (ops == 0) first_ns = tr.start_ns;
+        if (!max_speed && tr.start_ns > first_ns) {
+            uint64_t due = replay_start + (tr.start_ns - first_ns), now = now_ns();
+            if (due > now) usleep((useconds_t)((due - now) / 1000));
+        }
+
+        uint64_t t0 = now_ns();
+        int failed = 0;
+        if (tr.op == TRACE_CREATE) {
+            uint32_t seq;
+            failed = do_create(dev, name, &seq) < 0;
+            creates.lat_ns[creates.n++] = now_ns() - t0;
+        } else if (tr.op == TRACE_INSTALL) {
+            install_exclusive(dev, NULL);
+            installs.lat_ns[installs.n++] = now_ns() - t0;
+        } else {
+            fprintf(stderr, "run-trace: unknown op %u, stopping\n", tr.op);
+            break;
+        }
+        if (failed != tr.failed) mismatches++;
+        recorded_busy += tr.dur_ns;
+        ops++;
+    }
+
+    double secs = (double)(now_ns() - replay_start) / 1e9;
+    printf("run-trace: replayed %u op(s) in %.3fs (%.0f ops/s, %s)\n", ops, secs, secs > 0 ? ops / secs : 0.0,
+           max_speed ? "max speed" : "original timing");
+    print_latency("create", &creates);
+    print_latency("install", &installs);
+    printf("run-trace: recorded run spent %.3fs in operations; %u outcome(s) differ from the recording\n",
+           (double)recorded_busy / 1e9, mismatches);
+
+    free(creates.lat_ns);
+    free(installs.lat_ns);
+    free(buf);
+}
+
+// Parses a decimal argument into *out. Returns -1 for empty, signed,
+// non-numeric, trailing-garbage or out-of-range input.
+static int parse_u32(const char *s, uint32_t *out) {
+    if (*s < '0' || *s > '9') return -1;
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(s, &end, 10);
+    if (*end != '\0' || errno == ERANGE || v > UINT32_MAX) return -1;
+    *out = (uint32_t)v;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-f <image>] <command>\n"
+            "  create <name>\n"
+            "  stat <name>\n"
+            "  install [--archive <file>]\n"
+            "  compact\n"
+            "  snapshot <out> [seq]\n"
+            "  dump [--json]\n"
+            "  run-trace <trace> [--max-speed]\n"
+            "  ship <log|-> [--from <seq>] [--follow <ms>]\n"
+            "  apply <log|-> [--primary <image>]\n"
+            "  replay <archive|-> [--until <seq>|@<unix time>]\n"
+            "Set VSFS_TRACE=<file> to record creates and installs for run-trace.\n"
+            "Set VSFS_IOLOG=<file> to log image writes and fsyncs for crashsim,\n"
+            "and VSFS_BDEV=file|mmap|direct|uring|ram to pick the block-device backend.\n"
+            "Set VSFS_METRICS=<file> to export Prometheus metrics.\n"
+            "Set VSFS_COMPACT=1 to compact or install the journal as creates fill it,\n"
+            "and VSFS_TUNE to bound the tuned settings (see README).\n",
+            prog);
 }
 
 int main(int argc, char *argv[]) {
+    const char *prog = argv[0];
+    const char *image_path = "vsfs.img";
+    if (argc >= 3 && strcmp(argv[1], "-f") == 0) {
+        image_path = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
     if (argc < 2) {
-        fprintf(stderr, "usage:\n  %s create <name>\n  %s install\n", argv[0], argv[0]);
+        usage(prog);
         return 1;
     }
 
-    int fd = open("vsfs.img", O_RDWR);
-    if (fd < 0) die("open vsfs.img");
+    metrics_init();
+    blockdev_t *dev = bdev_open(image_path, BDEV_RDWR, 0);
+    if (!dev) die("open image");
+    const char *iolog = getenv("VSFS_IOLOG");
+    if (iolog && *iolog && bdev_log_io(dev, iolog) != 0) die("open iolog");
+
+    // Journal writers coordinate through <image>.ctl, and stat reads its
+    // cache. A ram image is private to this process.
+    static const char *const users[] = { "create", "install", "compact", "run-trace", "apply", "replay", "stat" };
+    for (size_t i = 0; i < sizeof(users) / sizeof(users[0]); i++) {
+        if (strcmp(argv[1], users[i]) != 0 || strcmp(bdev_backend(dev), "ram") == 0) continue;
+        ctl = jctl_open(image_path);
+        if (!ctl) fprintf(stderr, "journal: %s.ctl: %s; concurrent writers are not coordinated\n",
+                          image_path, strerror(errno));
+    }
 
+    int rc = 0;
     if (strcmp(argv[1], "create") == 0) {
         if (argc != 3) {
             fprintf(stderr, "create requires a filename\n");
             return 1;
         }
-        cmd_create(fd, argv[2]);
+        cmd_create(dev, argv[2]);
+    } else if (strcmp(argv[1], "stat") == 0) {
+        if (argc != 3) {
+            fprintf(stderr, "stat requires a filename\n");
+            return 1;
+        }
+        cmd_stat(dev, argv[2]);
     } else if (strcmp(argv[1], "install") == 0) {
-        cmd_install(fd);
+        if (argc == 4 && strcmp(argv[2], "--archive") == 0) {
+            cmd_install(dev, argv[3]);
+        } else if (argc == 2) {
+            cmd_install(dev, NULL);
+        } else {
+            usage(prog);
+            return 1;
+        }
+    } else if (strcmp(argv[1], "compact") == 0) {
+        if (argc != 2) {
+            usage(prog);
+            return 1;
+        }
+        cmd_compact(dev);
+    } else if (strcmp(argv[1], "run-trace") == 0) {
+        if (argc < 3 || argc > 4 || (argc == 4 && strcmp(argv[3], "--max-speed") != 0)) {
+            usage(prog);
+            return 1;
+        }
+        cmd_run_trace(dev, argv[2], argc == 4);
+    } else if (strcmp(argv[1], "dump") == 0) {
+        if (argc > 3 || (argc == 3 && strcmp(argv[2], "--json") != 0)) {
+            usage(prog);
+            return 1;
+        }
+        cmd_dump(dev, argc == 3);
+    } else if (strcmp(argv[1], "snapshot") == 0) {
+        if (argc != 3 && argc != 4) {
+            fprintf(stderr, "snapshot requires an output path\n");
+            return 1;
+        }
+        uint32_t seq = UINT32_MAX;
+        if (argc == 4 && parse_u32(argv[3], &seq) != 0) {
+            fprintf(stderr, "snapshot: bad sequence number '%s'\n", argv[3]);
+            return 1;
+        }
+        cmd_snapshot(dev, argv[2], seq);
+    } else if (strcmp(argv[1], "ship") == 0 || strcmp(argv[1], "apply") == 0 || strcmp(argv[1], "replay") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "%s requires a log path or '-'\n", argv[1]);
+            return 1;
+        }
+        uint32_t from = UINT32_MAX;
+        long follow_ms = 0;
+        const char *primary = NULL;
+        uint32_t until_seq = UINT32_MAX, until_time = UINT32_MAX;
+        // Each command takes only its own flags, each with one value
+        // (argv[argc] is NULL).
+        int ship = strcmp(argv[1], "ship") == 0, apply = strcmp(argv[1], "apply") == 0;
+        for (int i = 3; i < argc; i += 2) {
+            const char *opt = argv[i], *val = argv[i + 1];
+            int bad = 0;
+            if (ship && val && strcmp(opt, "--from") == 0) {
+                bad = parse_u32(val, &from);
+            } else if (ship && val && strcmp(opt, "--follow") == 0) {
+                uint32_t ms = 0;
+                bad = parse_u32(val, &ms);
+                follow_ms = (long)ms;
+            } else if (apply && val && strcmp(opt, "--primary") == 0) {
+                primary = val;
+            } else if (!ship && !apply && val && strcmp(opt, "--until") == 0) {
+                if (val[0] == '@') {
+                    bad = parse_u32(val + 1, &until_time);
+                } else {
+                    bad = parse_u32(val, &until_seq);
+                }
+            } else {
+                usage(prog);
+                return 1;
+            }
+            if (bad) {
+                fprintf(stderr, "%s: bad %s '%s'\n", argv[1], opt, val);
+                return 1;
+            }
+        }
+        if (ship) {
+            cmd_ship(dev, argv[2], from, follow_ms);
+        } else {
+            // The replica's journal is private to the apply for its whole run,
+            // and its metadata changes behind the control block.
+            uint32_t t = txn_enter(dev, 1);
+            if (ctl) jctl_invalidate(ctl);
+            // What was applied before a failure is installed and consistent.
+            rc = cmd_apply(dev, argv[1], argv[2], primary, until_seq, until_time);
+            txn_exit(dev, t, 1);
+        }
     } else {
         fprintf(stderr, "unknown command '%s'\n", argv[1]);
         return 1;
     }
 
-    close(fd);
-    return 0;
+    jctl_close(ctl);
+    bdev_close(dev);
+    return rc;
 }
@@ -0,0 +1,230 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blockdev.h"
+
+#define BLOCK_SIZE        4096U
+#define INODE_SIZE         128U
+#define JOURNAL_BLOCK_IDX    1U
+#define JOURNAL_BLOCKS      16U
+#define INODE_BLOCKS         2U
+#define DATA_BLOCKS         64U
+#define INODE_BMAP_IDX     (JOURNAL_BLOCK_IDX + JOURNAL_BLOCKS)
+#define DATA_BMAP_IDX      (INODE_BMAP_IDX + 1U)
+#define INODE_START_IDX    (DATA_BMAP_IDX + 1U)
+#define DATA_START_IDX     (INODE_START_IDX + INODE_BLOCKS)
+#define TOTAL_BLOCKS       (DATA_START_IDX + DATA_BLOCKS)
+#define INODE_COUNT        (INODE_BLOCKS * (BLOCK_SIZE / INODE_SIZE))
+#define DIRECT_POINTERS     8U
+
+// Metadata export format: a header, then `count` entries of a block number
+// followed by that block's contents. All-zero blocks are never stored.
+#define METAIMG_MAGIC   0x584d5356U // "VSMX"
+#define METAIMG_VERSION 1U
+
+struct metaimg_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t count;
+    uint32_t _reserved[3];
+};
+
+struct inode {
+    uint16_t type;
+    uint16_t links;
+    uint32_t size;
+
+    uint32_t direct[DIRECT_POINTERS];
+
+    uint32_t ctime;
+    uint32_t mtime;
+
+    uint8_t _pad[128 - (2 + 2 + 4 + DIRECT_POINTERS * 4 + 4 + 4)];
+};
+
+_Static_assert(sizeof(struct inode) == 128, "inode must be 128 bytes");
+_Static_assert(sizeof(struct metaimg_header) == 32, "metaimg header must be 32 bytes");
+
+static void die(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static void pread_block(blockdev_t *dev, uint32_t block_index, void *buf) {
+    if (bdev_read(dev, block_index, buf) != 0) {
+        die("pread");
+    }
+}
+
+static void pwrite_block(blockdev_t *dev, uint32_t block_index, const void *buf) {
+    if (bdev_write(dev, block_index, buf) != 0) {
+        die("pwrite");
+    }
+}
+
+static void write_all(int fd, const void *buf, size_t len) {
+    if (write(fd, buf, len) != (ssize_t)len) {
+        die("write");
+    }
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    return read(fd, buf, len) == (ssize_t)len;
+}
+
+static int is_zero(const uint8_t *block) {
+    for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+        if (block[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* -------------------- export -------------------- */
+
+// Exports every fixed metadata block plus the data blocks owned by
+// directories. File contents are never read, so the cost follows the amount
+// of metadata rather than the size of the image.
+static int cmd_export(const char *image_path, const char *out_path) {
+    blockdev_t *dev = bdev_open(image_path, BDEV_RDONLY, 0);
+    if (!dev) {
+        die("open image");
+    }
+
+    uint8_t wanted[TOTAL_BLOCKS];
+    memset(wanted, 0, sizeof(wanted));
+    for (uint32_t b = 0; b < DATA_START_IDX; ++b) {
+        wanted[b] = 1;
+    }
+
+    uint8_t *inode_area = malloc(INODE_BLOCKS * BLOCK_SIZE);
+    if (!inode_area) {
+        die("malloc inode area");
+    }
+    for (uint32_t i = 0; i < INODE_BLOCKS; ++i) {
+        pread_block(dev, INODE_START_IDX + i, inode_area + i * BLOCK_SIZE);
+    }
+    const struct inode *inodes = (const struct inode *)inode_area;
+    for (uint32_t i = 0; i < INODE_COUNT; ++i) {
+        if (inodes[i].type != 2) {
+            continue;
+        }
+        for (uint32_t d = 0; d < DIRECT_POINTERS; ++d) {
+            uint32_t blk = inodes[i].direct[d];
+            if (blk >= DATA_START_IDX && blk < TOTAL_BLOCKS) {
+                wanted[blk] = 1;
+            }
+        }
+    }
+    free(inode_area);
+
+    int out = open(out_path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (out < 0) {
+        die("open output");
+    }
+    struct metaimg_header hdr = {
+        .magic = METAIMG_MAGIC,
+        .version = METAIMG_VERSION,
+        .block_size = BLOCK_SIZE,
+        .total_blocks = TOTAL_BLOCKS,
+    };
+    write_all(out, &hdr, sizeof(hdr));
+
+    uint8_t block[BLOCK_SIZE];
+    uint32_t scanned = 0;
+    for (uint32_t b = 0; b < TOTAL_BLOCKS; ++b) {
+        if (!wanted[b]) {
+            continue;
+        }
+        pread_block(dev, b, block);
+        scanned++;
+        if (is_zero(block)) {
+            continue;
+        }
+        write_all(out, &b, sizeof(b));
+        write_all(out, block, BLOCK_SIZE);
+        hdr.count++;
+    }
+
+    if (pwrite(out, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+        die("pwrite header");
+    }
+    if (fsync(out) < 0 || close(out) < 0) {
+        die("close output");
+    }
+    bdev_close(dev);
+
+    printf("export: '%s' -> '%s': read %u metadata block(s), stored %u non-zero (%u bytes)\n", image_path,
+           out_path, scanned, hdr.count,
+           (uint32_t)(sizeof(hdr) + hdr.count * (sizeof(uint32_t) + BLOCK_SIZE)));
+    return 0;
+}
+
+/* -------------------- import -------------------- */
+
+// Rebuilds a full-size image: stored blocks go to their original location
+// and everything else, including file contents, reads back as zeroes.
+static int cmd_import(const char *in_path, const char *image_path) {
+    int in = open(in_path, O_RDONLY);
+    if (in < 0) {
+        die("open input");
+    }
+    struct metaimg_header hdr;
+    if (!read_all(in, &hdr, sizeof(hdr)) || hdr.magic != METAIMG_MAGIC) {
+        fprintf(stderr, "import: '%s' is not a metadata export\n", in_path);
+        return 1;
+    }
+    if (hdr.version != METAIMG_VERSION || hdr.block_size != BLOCK_SIZE || hdr.total_blocks != TOTAL_BLOCKS) {
+        fprintf(stderr, "import: unsupported export (version %u, block size %u, %u blocks)\n", hdr.version,
+                hdr.block_size, hdr.total_blocks);
+        return 1;
+    }
+
+    // The device is sized up front; untouched blocks stay holes.
+    blockdev_t *dev = bdev_open(image_path, BDEV_CREATE, hdr.total_blocks);
+    if (!dev) {
+        die("open image");
+    }
+
+    uint8_t block[BLOCK_SIZE];
+    for (uint32_t i = 0; i < hdr.count; ++i) {
+        uint32_t b;
+        if (!read_all(in, &b, sizeof(b)) || !read_all(in, block, BLOCK_SIZE)) {
+            fprintf(stderr, "import: export truncated after %u of %u block(s)\n", i, hdr.count);
+            return 1;
+        }
+        if (b >= hdr.total_blocks) {
+            fprintf(stderr, "import: block %u out of range\n", b);
+            return 1;
+        }
+        pwrite_block(dev, b, block);
+    }
+
+    if (bdev_sync(dev) < 0) {
+        die("sync image");
+    }
+    bdev_close(dev);
+    close(in);
+    printf("import: '%s' -> '%s': restored %u block(s) of %u\n", in_path, image_path, hdr.count,
+           hdr.total_blocks);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 4 && strcmp(argv[1], "export") == 0) {
+        return cmd_export(argv[2], argv[3]);
+    }
+    if (argc == 4 && strcmp(argv[1], "import") == 0) {
+        return cmd_import(argv[2], argv[3]);
+    }
+    fprintf(stderr, "usage:\n  %s export <image> <out>\n  %s import <in> <image>\n", argv[0], argv[0]);
+    return 1;
+}
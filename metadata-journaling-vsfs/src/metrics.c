@@ -0,0 +1,197 @@
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+#define METRICS_MAGIC   0x4d535356U // "VSSM"
+#define METRICS_VERSION 4U
+#define MAX_BUCKETS     12
+#define DEFAULT_INTERVAL 10
+
+struct hist_state {
+    uint64_t buckets[MAX_BUCKETS + 1]; // last one is +Inf
+    uint64_t count;
+    double sum;
+};
+
+// Layout of "<file>.state"; also used for this process's unflushed deltas.
+struct metrics_state {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t counters[M_COUNTERS];
+    uint64_t gauges[G_GAUGES];
+    uint64_t gauge_set; // bit per gauge written since the last flush (deltas only)
+    struct hist_state hists[H_HISTOGRAMS];
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} counter_defs[M_COUNTERS] = {
+    [M_COMMITS] = {"vsfs_commits_total", "Transactions committed to the journal."},
+    [M_COMMIT_FAILURES] = {"vsfs_commit_failures_total", "Creates refused before committing."},
+    [M_JOURNAL_FULL] = {"vsfs_journal_full_total", "Appends that found the journal full."},
+    [M_CHECKPOINTS] = {"vsfs_checkpoints_total", "Installs that applied a non-empty journal."},
+    [M_CHECKPOINT_TXNS] = {"vsfs_checkpoint_transactions_total", "Transactions applied by installs."},
+    [M_CHECKPOINT_BYTES] = {"vsfs_checkpoint_bytes_total", "Bytes written to home locations by installs."},
+    [M_OVERLAY_HITS] = {"vsfs_overlay_hits_total", "Metadata reads served from committed journal images."},
+    [M_OVERLAY_MISSES] = {"vsfs_overlay_misses_total", "Metadata reads served from home locations."},
+    [M_TXN_CONFLICTS] = {"vsfs_txn_conflicts_total", "Create plans invalidated by a concurrent commit and redone."},
+    [M_CACHE_HITS] = {"vsfs_meta_cache_hits_total", "Lookups served from the control block's metadata cache."},
+    [M_CACHE_MISSES] = {"vsfs_meta_cache_misses_total", "Lookups that read the journal and home locations instead."},
+    [M_COMPACTIONS] = {"vsfs_compactions_total", "Compactions that folded the journal's transactions into one."},
+    [M_COMPACTION_BYTES] = {"vsfs_compaction_bytes_total", "Journal bytes freed by compactions."},
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} gauge_defs[G_GAUGES] = {
+    [G_JOURNAL_BYTES] = {"vsfs_journal_bytes", "Journal bytes in use after the last operation."},
+    [G_CHECKPOINT_SEQ] = {"vsfs_checkpoint_seq", "Newest installed transaction."},
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+    int nbounds;
+    double bounds[MAX_BUCKETS];
+} hist_defs[H_HISTOGRAMS] = {
+    [H_TXN_RECORDS] = {"vsfs_txn_records", "Block records per committed transaction.", 9,
+                       {1, 2, 3, 4, 5, 6, 8, 16, 32}},
+    [H_COMMIT_SECONDS] = {"vsfs_commit_seconds", "Create latency including commit fsyncs.", 12,
+                          {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 1}},
+    [H_INODE_SCAN] = {"vsfs_inode_scan_length", "Inode bitmap bits examined per allocation.", 7,
+                      {1, 2, 4, 8, 16, 32, 64}},
+};
+
+static const char *metrics_path;
+static struct metrics_state delta;
+static time_t last_flush;
+
+void metrics_init(void) {
+    const char *path = getenv("VSFS_METRICS");
+    if (!path || !*path) {
+        return;
+    }
+    metrics_path = path;
+    last_flush = time(NULL);
+    atexit(metrics_flush);
+}
+
+void metrics_count(enum vsfs_counter c, uint64_t n) {
+    delta.counters[c] += n;
+}
+
+void metrics_set(enum vsfs_gauge g, uint64_t v) {
+    delta.gauges[g] = v;
+    delta.gauge_set |= 1ULL << g;
+}
+
+void metrics_observe(enum vsfs_histogram h, double v) {
+    struct hist_state *hs = &delta.hists[h];
+    int b = 0;
+    while (b < hist_defs[h].nbounds && v > hist_defs[h].bounds[b]) {
+        b++;
+    }
+    hs->buckets[b]++;
+    hs->count++;
+    hs->sum += v;
+}
+
+static void write_text(FILE *out, const struct metrics_state *st) {
+    for (int c = 0; c < M_COUNTERS; ++c) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_defs[c].name, counter_defs[c].help,
+                counter_defs[c].name, counter_defs[c].name, (unsigned long long)st->counters[c]);
+    }
+    for (int g = 0; g < G_GAUGES; ++g) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", gauge_defs[g].name, gauge_defs[g].help,
+                gauge_defs[g].name, gauge_defs[g].name, (unsigned long long)st->gauges[g]);
+    }
+    for (int h = 0; h < H_HISTOGRAMS; ++h) {
+        const char *name = hist_defs[h].name;
+        const struct hist_state *hs = &st->hists[h];
+        fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, hist_defs[h].help, name);
+        uint64_t cumulative = 0;
+        for (int b = 0; b < hist_defs[h].nbounds; ++b) {
+            cumulative += hs->buckets[b];
+            fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", name, hist_defs[h].bounds[b],
+                    (unsigned long long)cumulative);
+        }
+        fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9g\n%s_count %llu\n", name,
+                (unsigned long long)hs->count, name, hs->sum, name, (unsigned long long)hs->count);
+    }
+}
+
+void metrics_flush(void) {
+    if (!metrics_path) {
+        return;
+    }
+    char state_path[4096], tmp_path[4096];
+    snprintf(state_path, sizeof(state_path), "%s.state", metrics_path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", metrics_path, (int)getpid());
+
+    // The state file's lock serializes every process exporting to this path.
+    int sfd = open(state_path, O_RDWR | O_CREAT, 0644);
+    if (sfd < 0 || flock(sfd, LOCK_EX) < 0) {
+        perror("metrics state");
+        if (sfd >= 0) close(sfd);
+        return;
+    }
+    struct metrics_state st;
+    if (pread(sfd, &st, sizeof(st), 0) != (ssize_t)sizeof(st) || st.magic != METRICS_MAGIC ||
+        st.version != METRICS_VERSION) {
+        memset(&st, 0, sizeof(st));
+        st.magic = METRICS_MAGIC;
+        st.version = METRICS_VERSION;
+    }
+    for (int c = 0; c < M_COUNTERS; ++c) {
+        st.counters[c] += delta.counters[c];
+    }
+    for (int g = 0; g < G_GAUGES; ++g) {
+        if (delta.gauge_set & (1ULL << g)) {
+            st.gauges[g] = delta.gauges[g];
+        }
+    }
+    for (int h = 0; h < H_HISTOGRAMS; ++h) {
+        for (int b = 0; b <= MAX_BUCKETS; ++b) {
+            st.hists[h].buckets[b] += delta.hists[h].buckets[b];
+        }
+        st.hists[h].count += delta.hists[h].count;
+        st.hists[h].sum += delta.hists[h].sum;
+    }
+    if (pwrite(sfd, &st, sizeof(st), 0) != (ssize_t)sizeof(st)) {
+        perror("metrics state");
+    }
+
+    FILE *out = fopen(tmp_path, "w");
+    if (out) {
+        write_text(out, &st);
+        if (fclose(out) != 0 || rename(tmp_path, metrics_path) != 0) {
+            perror("metrics");
+            unlink(tmp_path);
+        }
+    } else {
+        perror("metrics");
+    }
+    close(sfd); // drops the lock
+
+    memset(&delta, 0, sizeof(delta));
+    last_flush = time(NULL);
+}
+
+void metrics_tick(void) {
+    if (!metrics_path) {
+        return;
+    }
+    const char *env = getenv("VSFS_METRICS_INTERVAL");
+    long interval = env && *env ? strtol(env, NULL, 10) : DEFAULT_INTERVAL;
+    if (time(NULL) - last_flush >= interval) {
+        metrics_flush();
+    }
+}
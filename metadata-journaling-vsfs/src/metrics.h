@@ -0,0 +1,51 @@
+#ifndef VSFS_METRICS_H
+#define VSFS_METRICS_H
+
+#include <stdint.h>
+
+// Counters, gauges and histograms exported in Prometheus text format to the
+// file named by VSFS_METRICS, for a node exporter's textfile collector.
+// Values accumulate across processes in "<file>.state"; every flush merges
+// this process's deltas into it under a lock and rewrites the text file with
+// an atomic rename. Without VSFS_METRICS every call is a no-op.
+enum vsfs_counter {
+    M_COMMITS,           // transactions committed to the journal
+    M_COMMIT_FAILURES,   // creates refused (name, space, journal full)
+    M_JOURNAL_FULL,      // appends that found the journal full
+    M_CHECKPOINTS,       // installs that applied a non-empty journal
+    M_CHECKPOINT_TXNS,   // transactions applied by installs
+    M_CHECKPOINT_BYTES,  // bytes written to home locations by installs
+    M_OVERLAY_HITS,      // metadata reads served from committed journal images
+    M_OVERLAY_MISSES,    // metadata reads that went to the home location
+    M_TXN_CONFLICTS,     // create plans invalidated by a concurrent commit
+    M_CACHE_HITS,        // lookups served from the control block's metadata cache
+    M_CACHE_MISSES,      // lookups that read the journal and home locations instead
+    M_COMPACTIONS,       // compactions that folded the journal
+    M_COMPACTION_BYTES,  // journal bytes freed by compactions
+    M_COUNTERS
+};
+
+enum vsfs_gauge {
+    G_JOURNAL_BYTES,     // journal occupancy after the last operation
+    G_CHECKPOINT_SEQ,    // newest installed transaction
+    G_GAUGES
+};
+
+enum vsfs_histogram {
+    H_TXN_RECORDS,       // block records per committed transaction
+    H_COMMIT_SECONDS,    // create latency, including the commit fsyncs
+    H_INODE_SCAN,        // inode bitmap bits examined to allocate an inode
+    H_HISTOGRAMS
+};
+
+void metrics_init(void);
+void metrics_count(enum vsfs_counter c, uint64_t n);
+void metrics_set(enum vsfs_gauge g, uint64_t v);
+void metrics_observe(enum vsfs_histogram h, double v);
+
+// Writes the file now; metrics_tick does so only every VSFS_METRICS_INTERVAL
+// seconds (default 10), for long-running commands.
+void metrics_flush(void);
+void metrics_tick(void);
+
+#endif
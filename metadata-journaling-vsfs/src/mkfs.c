@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
@@ -7,6 +8,8 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "blockdev.h"
+
 #define FS_MAGIC 0x56534653U
 
 #define BLOCK_SIZE        4096U
@@ -20,8 +23,12 @@
 #define INODE_START_IDX    (DATA_BMAP_IDX + 1U)
 #define DATA_START_IDX     (INODE_START_IDX + INODE_BLOCKS)
 #define TOTAL_BLOCKS       (DATA_START_IDX + DATA_BLOCKS)
+#define INODE_COUNT        (INODE_BLOCKS * (BLOCK_SIZE / INODE_SIZE))
+#define DIRECT_POINTERS     8U
 #define DEFAULT_IMAGE "vsfs.img"
 
+#define FS_STATE_CLEAN 0x1U // journal is empty; set by install, cleared by create
+
 struct superblock {
     uint32_t magic;
     uint32_t block_size;
@@ -34,7 +41,11 @@ struct superblock {
     uint32_t inode_start;
     uint32_t data_start;
 
-    uint8_t  _pad[128 - 9 * 4];
+    uint32_t state;
+    uint32_t checkpoint_seq;
+    uint32_t install_gen;
+
+    uint8_t  _pad[128 - 12 * 4];
 };
 
 struct inode {
@@ -64,9 +75,11 @@ static void die(const char *msg) {
     exit(EXIT_FAILURE);
 }
 
-static void write_block(int fd, const void *block) {
-    ssize_t written = write(fd, block, BLOCK_SIZE);
-    if (written != (ssize_t)BLOCK_SIZE) {
+// mkfs writes the image front to back, one block after the other.
+static uint32_t write_cursor;
+
+static void write_block(blockdev_t *dev, const void *block) {
+    if (bdev_write(dev, write_cursor++, block) != 0) {
         die("write");
     }
 }
@@ -75,11 +88,141 @@ static void set_bitmap(uint8_t *bitmap, uint32_t index) {
     bitmap[index / 8] |= (uint8_t)(1U << (index % 8));
 }
 
+/* -------------------- manifest -------------------- */
+
+// Blocks that depend on the manifest; everything else in a fresh image is zero.
+struct layout {
+    uint8_t inode_bitmap[BLOCK_SIZE];
+    uint8_t data_bitmap[BLOCK_SIZE];
+    uint8_t inode_table[INODE_BLOCKS][BLOCK_SIZE];
+    uint8_t root_dir[BLOCK_SIZE];
+    uint32_t files;
+    uint32_t data_used;
+};
+
+static int manifest_error(const char *path, unsigned line, const char *why) {
+    fprintf(stderr, "mkfs: %s:%u: %s\n", path, line, why);
+    return -1;
+}
+
+// Lays out one regular file per manifest line ("name [size]") directly in
+// the inode table, bitmaps and root directory, in a single pass with no
+// journaling. Inodes and data blocks are handed out in order, so every file
+// is contiguous.
+static int populate(struct layout *lo, const char *path, uint32_t now) {
+    FILE *mf = fopen(path, "r");
+    if (!mf) {
+        die("open manifest");
+    }
+    struct inode *inodes = (struct inode *)lo->inode_table;
+    struct dirent *dir = (struct dirent *)lo->root_dir;
+    uint32_t next_block = 1; // data block 0 is the root directory
+    char line[512];
+    unsigned lineno = 0;
+    while (fgets(line, sizeof(line), mf)) {
+        lineno++;
+        char name[64];
+        unsigned long size = 0;
+        int used = 0;
+        if (sscanf(line, "%63s%n", name, &used) < 1 || name[0] == '#') {
+            continue;
+        }
+        // The size is optional, but must be all digits ("12k" is not 12).
+        const char *p = line + used;
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p) {
+            char *end = NULL;
+            errno = 0;
+            if (isdigit((unsigned char)*p)) {
+                size = strtoul(p, &end, 10);
+            }
+            if (!end || errno == ERANGE) {
+                return manifest_error(path, lineno, "size is not a number of bytes");
+            }
+            while (isspace((unsigned char)*end)) {
+                end++;
+            }
+            if (*end) {
+                return manifest_error(path, lineno, "unexpected text after the size");
+            }
+        }
+        if (strlen(name) >= sizeof(dir[0].name)) {
+            return manifest_error(path, lineno, "name too long (max 27 chars)");
+        }
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            return manifest_error(path, lineno, "invalid name");
+        }
+        if (size > DIRECT_POINTERS * BLOCK_SIZE) {
+            return manifest_error(path, lineno, "file larger than 8 direct blocks");
+        }
+        uint32_t entry = 2 + lo->files;
+        for (uint32_t e = 2; e < entry; ++e) {
+            if (strcmp(dir[e].name, name) == 0) {
+                return manifest_error(path, lineno, "duplicate name");
+            }
+        }
+        uint32_t inum = 1 + lo->files;
+        uint32_t nblocks = (uint32_t)((size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        if (inum >= INODE_COUNT || entry >= BLOCK_SIZE / sizeof(struct dirent)) {
+            return manifest_error(path, lineno, "no free inode left in the image");
+        }
+        if (next_block + nblocks > DATA_BLOCKS) {
+            return manifest_error(path, lineno, "no free data blocks left in the image");
+        }
+
+        struct inode *ino = &inodes[inum];
+        ino->type = 1;
+        ino->links = 1;
+        ino->size = (uint32_t)size;
+        ino->ctime = now;
+        ino->mtime = now;
+        for (uint32_t d = 0; d < nblocks; ++d) {
+            set_bitmap(lo->data_bitmap, next_block);
+            ino->direct[d] = DATA_START_IDX + next_block++;
+        }
+        set_bitmap(lo->inode_bitmap, inum);
+
+        dir[entry].inode = inum;
+        memcpy(dir[entry].name, name, strlen(name) + 1);
+        lo->files++;
+    }
+    fclose(mf);
+    lo->data_used = next_block;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [image] [--manifest <file>]\n", prog);
+}
+
 int main(int argc, char *argv[]) {
-    const char *image_path = (argc > 1) ? argv[1] : DEFAULT_IMAGE;
+    const char *image_path = DEFAULT_IMAGE;
+    const char *manifest = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            image_path = argv[i];
+        }
+    }
 
-    int fd = open(image_path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
-    if (fd < 0) {
+    time_t now = time(NULL);
+
+    static struct layout lo;
+    set_bitmap(lo.inode_bitmap, 0); // Reserve inode 0 for root
+    set_bitmap(lo.data_bitmap, 0); // Reserve first data block for root directory
+    // Parse the manifest before touching the image, so a bad one leaves it alone.
+    if (manifest && populate(&lo, manifest, (uint32_t)now) < 0) {
+        return 1;
+    }
+
+    blockdev_t *dev = bdev_open(image_path, BDEV_CREATE, TOTAL_BLOCKS);
+    if (!dev) {
         die("open");
     }
 
@@ -90,67 +233,60 @@ int main(int argc, char *argv[]) {
         .magic = FS_MAGIC,
         .block_size = BLOCK_SIZE,
         .total_blocks = TOTAL_BLOCKS,
-        .inode_count = INODE_BLOCKS * (BLOCK_SIZE / INODE_SIZE),
+        .inode_count = INODE_COUNT,
         .journal_block = JOURNAL_BLOCK_IDX,
         .inode_bitmap = INODE_BMAP_IDX,
         .data_bitmap = DATA_BMAP_IDX,
         .inode_start = INODE_START_IDX,
         .data_start = DATA_START_IDX,
+        .state = FS_STATE_CLEAN,
     };
 
     memcpy(block, &sb, sizeof(sb));
-    write_block(fd, block); // Superblock
+    write_block(dev, block); // Superblock
 
     memset(block, 0, sizeof(block));
     for (uint32_t i = 0; i < JOURNAL_BLOCKS; ++i) {
-        write_block(fd, block); // Journal blocks
+        write_block(dev, block); // Journal blocks
     }
 
-    memset(block, 0, sizeof(block));
-    set_bitmap(block, 0); // Reserve inode 0 for root
-    write_block(fd, block); // Inode bitmap
-
-    memset(block, 0, sizeof(block));
-    set_bitmap(block, 0); // Reserve first data block for root directory
-    write_block(fd, block); // Data bitmap
-
-    time_t now = time(NULL);
+    write_block(dev, lo.inode_bitmap); // Inode bitmap
+    write_block(dev, lo.data_bitmap); // Data bitmap
 
     struct inode root = {0};
     root.type = 2; // directory
     root.links = 2; // "." and ".."
-    root.size = 2 * sizeof(struct dirent);
+    root.size = (2 + lo.files) * sizeof(struct dirent);
     memset(root.direct, 0, sizeof(root.direct));
     root.direct[0] = DATA_START_IDX;
     root.ctime = (uint32_t)now;
     root.mtime = (uint32_t)now;
 
-    memset(block, 0, sizeof(block));
-    memcpy(block, &root, sizeof(root));
-    write_block(fd, block); // First inode block
-
-    memset(block, 0, sizeof(block));
-    write_block(fd, block); // Second inode block
+    memcpy(lo.inode_table[0], &root, sizeof(root));
+    write_block(dev, lo.inode_table[0]); // First inode block
+    write_block(dev, lo.inode_table[1]); // Second inode block
 
-    memset(block, 0, sizeof(block));
-    struct dirent *root_dirents = (struct dirent *)block;
+    struct dirent *root_dirents = (struct dirent *)lo.root_dir;
     root_dirents[0].inode = 0;
     strncpy(root_dirents[0].name, ".", sizeof(root_dirents[0].name) - 1);
     root_dirents[0].name[sizeof(root_dirents[0].name) - 1] = '\0';
     root_dirents[1].inode = 0;
     strncpy(root_dirents[1].name, "..", sizeof(root_dirents[1].name) - 1);
     root_dirents[1].name[sizeof(root_dirents[1].name) - 1] = '\0';
-    write_block(fd, block); // First data block holds root directory entries
+    write_block(dev, lo.root_dir); // First data block holds root directory entries
 
     memset(block, 0, sizeof(block));
     for (uint32_t i = 1; i < DATA_BLOCKS; ++i) {
-        write_block(fd, block);
+        write_block(dev, block);
     }
 
-    if (close(fd) < 0) {
-        die("close");
-    }
+    bdev_close(dev);
 
-    printf("Created VSFS image '%s' (%u blocks).\n", image_path, TOTAL_BLOCKS);
+    if (manifest) {
+        printf("Created VSFS image '%s' (%u blocks) with %u file(s) from '%s', %u data block(s) in use.\n",
+               image_path, TOTAL_BLOCKS, lo.files, manifest, lo.data_used);
+    } else {
+        printf("Created VSFS image '%s' (%u blocks).\n", image_path, TOTAL_BLOCKS);
+    }
     return 0;
 }
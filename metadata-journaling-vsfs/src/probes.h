@@ -0,0 +1,29 @@
+#ifndef VSFS_PROBES_H
+#define VSFS_PROBES_H
+
+// Static tracepoints under the USDT provider "vsfs". With <sys/sdt.h>
+// (systemtap-sdt-dev) each probe compiles to a single nop plus an ELF note
+// that perf, bpftrace and systemtap can attach to; the arguments are only
+// read when a tracer is attached. Without the header the probes vanish.
+//
+//   bpftrace -e 'usdt:./journal:vsfs:txn_commit { printf("%d\n", arg0); }'
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define VSFS_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef VSFS_HAVE_SDT
+#define VSFS_PROBE0(name) DTRACE_PROBE(vsfs, name)
+#define VSFS_PROBE1(name, a) DTRACE_PROBE1(vsfs, name, a)
+#define VSFS_PROBE2(name, a, b) DTRACE_PROBE2(vsfs, name, a, b)
+#define VSFS_PROBE3(name, a, b, c) DTRACE_PROBE3(vsfs, name, a, b, c)
+#else
+#define VSFS_PROBE0(name) do { } while (0)
+#define VSFS_PROBE1(name, a) do { (void)(a); } while (0)
+#define VSFS_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define VSFS_PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,637 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blockdev.h"
+
+#define FS_MAGIC 0x56534653U
+
+#define BLOCK_SIZE        4096U
+#define INODE_SIZE         128U
+#define JOURNAL_BLOCK_IDX    1U
+#define JOURNAL_BLOCKS      16U
+#define INODE_BLOCKS         2U
+#define DATA_BLOCKS         64U
+#define INODE_BMAP_IDX     (JOURNAL_BLOCK_IDX + JOURNAL_BLOCKS)
+#define DATA_BMAP_IDX      (INODE_BMAP_IDX + 1U)
+#define INODE_START_IDX    (DATA_BMAP_IDX + 1U)
+#define DATA_START_IDX     (INODE_START_IDX + INODE_BLOCKS)
+#define TOTAL_BLOCKS       (DATA_START_IDX + DATA_BLOCKS)
+#define INODE_COUNT        (INODE_BLOCKS * (BLOCK_SIZE / INODE_SIZE))
+#define DIRECT_POINTERS     8U
+#define DEFAULT_IMAGE "vsfs.img"
+
+#define FS_STATE_CLEAN 0x1U // journal is empty; set by install, cleared by create
+
+// Journal format (must match journal.c)
+#define JOURNAL_MAGIC 0xdeadbeefU
+#define JOURNAL_BYTES (JOURNAL_BLOCKS * BLOCK_SIZE)
+#define REC_DATA   1U
+#define REC_COMMIT 2U
+#define REC_PAD    3U
+
+// Persistent scrub state, kept next to the image as "<image>.scrub"
+#define SCRUB_MAGIC 0x53435242U
+#define PROGRESS_INTERVAL 1U // seconds between progress lines
+
+struct superblock {
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t inode_count;
+
+    uint32_t journal_block;
+    uint32_t inode_bitmap;
+    uint32_t data_bitmap;
+    uint32_t inode_start;
+    uint32_t data_start;
+
+    uint32_t state;
+    uint32_t checkpoint_seq;
+    uint32_t install_gen;
+
+    uint8_t  _pad[128 - 12 * 4];
+};
+
+struct inode {
+    uint16_t type;
+    uint16_t links;
+    uint32_t size;
+
+    uint32_t direct[DIRECT_POINTERS];
+
+    uint32_t ctime;
+    uint32_t mtime;
+
+    uint8_t _pad[128 - (2 + 2 + 4 + DIRECT_POINTERS * 4 + 4 + 4)];
+};
+
+struct dirent {
+    uint32_t inode;
+    char name[28];
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t nbytes;
+} journal_header_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+} rec_header_t;
+
+#define DATA_REC_SIZE   (sizeof(rec_header_t) + sizeof(uint32_t) + BLOCK_SIZE)
+#define COMMIT_REC_SIZE (sizeof(rec_header_t) + 2 * sizeof(uint32_t))
+
+struct scrub_state {
+    uint32_t magic;
+    uint32_t cursor;        // next block to scrub
+    uint64_t passes;        // completed full passes
+    uint64_t blocks;        // blocks scrubbed, all runs
+    uint64_t findings;      // findings reported, all runs
+    uint64_t read_errors;   // unreadable blocks, all runs
+    uint64_t last_pass_end; // wall-clock time of the last completed pass
+};
+
+_Static_assert(sizeof(struct superblock) == 128, "superblock must be 128 bytes");
+_Static_assert(sizeof(struct inode) == 128, "inode must be 128 bytes");
+_Static_assert(sizeof(struct dirent) == 32, "dirent must be 32 bytes");
+
+struct scrub_stats {
+    uint64_t meta_blocks;
+    uint64_t data_blocks;
+    uint64_t reads;
+    uint64_t read_errors;
+    uint64_t findings;
+    uint64_t throttled_ns;
+};
+
+static struct scrub_stats stats;
+static uint32_t rate_limit = 0; // block reads per second, 0 = unthrottled
+static struct timespec budget_start;
+static uint64_t budget_reads = 0;
+
+static void die(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static void report_finding(uint32_t block, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "FINDING: block %u: ", block);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+    stats.findings++;
+}
+
+static uint64_t elapsed_ns(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - since->tv_sec) * 1000000000ULL +
+           (uint64_t)(now.tv_nsec - since->tv_nsec);
+}
+
+// Sleeps as needed so reads stay under rate_limit per second on average.
+static void throttle(void) {
+    budget_reads++;
+    if (rate_limit == 0) {
+        return;
+    }
+    uint64_t due_ns = budget_reads * 1000000000ULL / rate_limit;
+    uint64_t spent_ns = elapsed_ns(&budget_start);
+    if (due_ns <= spent_ns) {
+        return;
+    }
+    uint64_t wait_ns = due_ns - spent_ns;
+    struct timespec ts = { .tv_sec = (time_t)(wait_ns / 1000000000ULL),
+                           .tv_nsec = (long)(wait_ns % 1000000000ULL) };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+    stats.throttled_ns += wait_ns;
+}
+
+// Unlike the validator, a failed read is a finding, not fatal: latent media
+// errors are exactly what a scrub is meant to surface.
+static int scrub_read(blockdev_t *dev, uint32_t block_index, void *buf) {
+    throttle();
+    stats.reads++;
+    if (bdev_read(dev, block_index, buf) != 0) {
+        stats.read_errors++;
+        report_finding(block_index, "unreadable (%s)", errno == EIO ? "short read" : strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int bitmap_test(const uint8_t *bitmap, uint32_t index) {
+    return (bitmap[index / 8] >> (index % 8)) & 0x1;
+}
+
+/* -------------------- per-run context -------------------- */
+
+// Allocation metadata is loaded once per run so each data block can be
+// checked against its owner without rereading the inode table.
+struct scrub_ctx {
+    blockdev_t *dev;
+    uint8_t inode_bitmap[BLOCK_SIZE];
+    uint8_t data_bitmap[BLOCK_SIZE];
+    struct inode inodes[INODE_COUNT];
+    int data_owner[DATA_BLOCKS];
+    uint32_t dir_refs[INODE_COUNT];
+    int clean; // superblock says the journal is empty
+};
+
+static void load_ctx(struct scrub_ctx *ctx) {
+    memset(ctx->inode_bitmap, 0, sizeof(ctx->inode_bitmap));
+    memset(ctx->data_bitmap, 0, sizeof(ctx->data_bitmap));
+    memset(ctx->inodes, 0, sizeof(ctx->inodes));
+    memset(ctx->data_owner, -1, sizeof(ctx->data_owner));
+    memset(ctx->dir_refs, 0, sizeof(ctx->dir_refs));
+    ctx->clean = 0;
+
+    uint8_t block[BLOCK_SIZE];
+    if (scrub_read(ctx->dev, 0, block) == 0) {
+        ctx->clean = (((const struct superblock *)block)->state & FS_STATE_CLEAN) != 0;
+    }
+    scrub_read(ctx->dev, INODE_BMAP_IDX, ctx->inode_bitmap);
+    scrub_read(ctx->dev, DATA_BMAP_IDX, ctx->data_bitmap);
+    for (uint32_t i = 0; i < INODE_BLOCKS; ++i) {
+        scrub_read(ctx->dev, INODE_START_IDX + i, (uint8_t *)ctx->inodes + i * BLOCK_SIZE);
+    }
+    for (uint32_t i = 0; i < INODE_COUNT; ++i) {
+        if (ctx->inodes[i].type == 0) {
+            continue;
+        }
+        for (uint32_t d = 0; d < DIRECT_POINTERS; ++d) {
+            uint32_t blk = ctx->inodes[i].direct[d];
+            if (blk >= DATA_START_IDX && blk < DATA_START_IDX + DATA_BLOCKS &&
+                ctx->data_owner[blk - DATA_START_IDX] == -1) {
+                ctx->data_owner[blk - DATA_START_IDX] = (int)i;
+            }
+        }
+    }
+}
+
+/* -------------------- block checks -------------------- */
+
+static void scrub_superblock(struct scrub_ctx *ctx) {
+    uint8_t block[BLOCK_SIZE];
+    if (scrub_read(ctx->dev, 0, block) != 0) {
+        return;
+    }
+    const struct superblock *sb = (const struct superblock *)block;
+    if (sb->magic != FS_MAGIC) {
+        report_finding(0, "invalid superblock magic 0x%08x", sb->magic);
+    }
+    if (sb->block_size != BLOCK_SIZE || sb->total_blocks != TOTAL_BLOCKS ||
+        sb->inode_count != INODE_COUNT || sb->journal_block != JOURNAL_BLOCK_IDX ||
+        sb->inode_bitmap != INODE_BMAP_IDX || sb->data_bitmap != DATA_BMAP_IDX ||
+        sb->inode_start != INODE_START_IDX || sb->data_start != DATA_START_IDX) {
+        report_finding(0, "superblock geometry does not match the fixed layout");
+    }
+}
+
+// On a clean image only the header needs to be read: it must be empty.
+static void scrub_clean_journal(struct scrub_ctx *ctx) {
+    uint8_t block[BLOCK_SIZE];
+    if (scrub_read(ctx->dev, JOURNAL_BLOCK_IDX, block) != 0) {
+        return;
+    }
+    const journal_header_t *jh = (const journal_header_t *)block;
+    if (jh->magic == JOURNAL_MAGIC && jh->nbytes != sizeof(journal_header_t)) {
+        report_finding(JOURNAL_BLOCK_IDX, "image is marked clean but journal holds %u byte(s)", jh->nbytes);
+    }
+}
+
+// The journal is scrubbed as one unit: records may straddle block boundaries.
+static void scrub_journal(struct scrub_ctx *ctx) {
+    if (ctx->clean) {
+        scrub_clean_journal(ctx);
+        return;
+    }
+    unsigned char *jbuf = malloc(JOURNAL_BYTES);
+    if (!jbuf) {
+        die("malloc journal");
+    }
+    for (uint32_t i = 0; i < JOURNAL_BLOCKS; ++i) {
+        if (scrub_read(ctx->dev, JOURNAL_BLOCK_IDX + i, jbuf + i * BLOCK_SIZE) != 0) {
+            free(jbuf);
+            return;
+        }
+    }
+
+    const journal_header_t *jh = (const journal_header_t *)jbuf;
+    if (jh->magic != JOURNAL_MAGIC) {
+        // A never-used journal is all zeroes; anything else is damage.
+        for (uint32_t i = 0; i < JOURNAL_BYTES; ++i) {
+            if (jbuf[i] != 0) {
+                report_finding(JOURNAL_BLOCK_IDX, "journal has bad magic 0x%08x", jh->magic);
+                break;
+            }
+        }
+        free(jbuf);
+        return;
+    }
+    if (jh->nbytes < sizeof(journal_header_t) || jh->nbytes > JOURNAL_BYTES) {
+        report_finding(JOURNAL_BLOCK_IDX, "journal length %u out of range", jh->nbytes);
+        free(jbuf);
+        return;
+    }
+
+    uint32_t off = (uint32_t)sizeof(journal_header_t);
+    uint32_t last_seq = 0;
+    while (off + sizeof(rec_header_t) <= jh->nbytes) {
+        const rec_header_t *rh = (const rec_header_t *)(jbuf + off);
+        uint32_t blk = JOURNAL_BLOCK_IDX + off / BLOCK_SIZE;
+        if (rh->type == REC_DATA && rh->size == DATA_REC_SIZE && rh->size <= jh->nbytes - off) {
+            uint32_t target;
+            memcpy(&target, jbuf + off + sizeof(rec_header_t), sizeof(target));
+            if (target < INODE_BMAP_IDX || target >= TOTAL_BLOCKS) {
+                report_finding(blk, "journal record at offset %u targets block %u outside metadata/data", off, target);
+            }
+        } else if (rh->type == REC_PAD && rh->size >= sizeof(rec_header_t) && rh->size <= JOURNAL_BYTES &&
+                   rh->size <= jh->nbytes - off) {
+            // space skipped by journal compaction
+        } else if (rh->type != REC_COMMIT || rh->size != COMMIT_REC_SIZE || rh->size > jh->nbytes - off) {
+            report_finding(blk, "malformed journal record at offset %u (type %u size %u)", off, rh->type, rh->size);
+            break;
+        } else {
+            uint32_t seq;
+            memcpy(&seq, jbuf + off + sizeof(rec_header_t), sizeof(seq));
+            if (seq <= last_seq) {
+                report_finding(blk, "journal commit at offset %u has seq %u after seq %u", off, seq, last_seq);
+            }
+            last_seq = seq;
+        }
+        off += rh->size;
+    }
+    free(jbuf);
+}
+
+static void scrub_bitmap(struct scrub_ctx *ctx, uint32_t block_index) {
+    uint8_t bitmap[BLOCK_SIZE];
+    if (scrub_read(ctx->dev, block_index, bitmap) != 0) {
+        return;
+    }
+    int is_inode = block_index == INODE_BMAP_IDX;
+    uint32_t valid_bits = is_inode ? INODE_COUNT : DATA_BLOCKS;
+    for (uint32_t bit = valid_bits; bit < BLOCK_SIZE * 8; ++bit) {
+        if (bitmap_test(bitmap, bit)) {
+            report_finding(block_index, "stray bit set at %u", bit);
+            break;
+        }
+    }
+    for (uint32_t bit = 0; bit < valid_bits; ++bit) {
+        int used = is_inode ? ctx->inodes[bit].type != 0 : ctx->data_owner[bit] != -1;
+        if (bitmap_test(bitmap, bit) != used) {
+            report_finding(block_index, "bit %u is %s but %s is %s", bit,
+                           bitmap_test(bitmap, bit) ? "set" : "clear",
+                           is_inode ? "inode" : "data block",
+                           used ? "in use" : "unreferenced");
+        }
+    }
+}
+
+static void scrub_inode_block(struct scrub_ctx *ctx, uint32_t block_index) {
+    uint8_t block[BLOCK_SIZE];
+    if (scrub_read(ctx->dev, block_index, block) != 0) {
+        return;
+    }
+    const struct inode *inodes = (const struct inode *)block;
+    uint32_t first = (block_index - INODE_START_IDX) * (BLOCK_SIZE / INODE_SIZE);
+    for (uint32_t k = 0; k < BLOCK_SIZE / INODE_SIZE; ++k) {
+        const struct inode *ino = &inodes[k];
+        uint32_t inum = first + k;
+        if (ino->type == 0) {
+            continue;
+        }
+        if (ino->type > 2) {
+            report_finding(block_index, "inode %u has invalid type %u", inum, ino->type);
+        }
+        uint32_t required = (ino->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        uint32_t seen = 0;
+        for (uint32_t d = 0; d < DIRECT_POINTERS; ++d) {
+            uint32_t blk = ino->direct[d];
+            if (blk == 0) {
+                continue;
+            }
+            seen++;
+            if (blk < DATA_START_IDX || blk >= DATA_START_IDX + DATA_BLOCKS) {
+                report_finding(block_index, "inode %u points outside data region (block %u)", inum, blk);
+            } else if (ctx->data_owner[blk - DATA_START_IDX] != (int)inum) {
+                report_finding(block_index, "inode %u shares data block %u with inode %d",
+                               inum, blk, ctx->data_owner[blk - DATA_START_IDX]);
+            }
+        }
+        if (seen < required) {
+            report_finding(block_index, "inode %u lacks blocks for size %u", inum, ino->size);
+        }
+    }
+}
+
+static void scrub_dir_block(struct scrub_ctx *ctx, uint32_t block_index, const uint8_t *block,
+                            const struct inode *dir, uint32_t dir_index) {
+    uint32_t slot = 0;
+    while (slot < DIRECT_POINTERS && dir->direct[slot] != block_index) {
+        slot++;
+    }
+    uint32_t used = 0;
+    if (dir->size > slot * BLOCK_SIZE) {
+        used = dir->size - slot * BLOCK_SIZE;
+        if (used > BLOCK_SIZE) {
+            used = BLOCK_SIZE;
+        }
+    }
+    const struct dirent *des = (const struct dirent *)block;
+    for (uint32_t e = 0; e < used / sizeof(struct dirent); ++e) {
+        const struct dirent *de = &des[e];
+        if (de->inode == 0 && de->name[0] == '\0') {
+            continue;
+        }
+        if (memchr(de->name, '\0', sizeof(de->name)) == NULL || de->name[0] == '\0') {
+            report_finding(block_index, "directory %u entry %u has a bad name", dir_index, e);
+            continue;
+        }
+        if (de->inode >= INODE_COUNT) {
+            report_finding(block_index, "directory %u entry '%s' points to out-of-range inode %u",
+                           dir_index, de->name, de->inode);
+            continue;
+        }
+        if (ctx->inodes[de->inode].type == 0) {
+            report_finding(block_index, "directory %u entry '%s' references free inode %u",
+                           dir_index, de->name, de->inode);
+        }
+        ctx->dir_refs[de->inode]++;
+    }
+}
+
+static void scrub_data_block(struct scrub_ctx *ctx, uint32_t block_index) {
+    uint8_t block[BLOCK_SIZE];
+    if (scrub_read(ctx->dev, block_index, block) != 0) {
+        return;
+    }
+    int owner = ctx->data_owner[block_index - DATA_START_IDX];
+    if (owner >= 0 && ctx->inodes[owner].type == 2) {
+        scrub_dir_block(ctx, block_index, block, &ctx->inodes[owner], (uint32_t)owner);
+    }
+}
+
+// Link counts can only be judged once every directory block has been seen,
+// so this runs at the end of a pass that covered the whole data region.
+static void scrub_link_counts(struct scrub_ctx *ctx) {
+    for (uint32_t i = 0; i < INODE_COUNT; ++i) {
+        if (ctx->inodes[i].type != 0 && ctx->inodes[i].links != ctx->dir_refs[i]) {
+            report_finding(INODE_START_IDX + i / (BLOCK_SIZE / INODE_SIZE),
+                           "inode %u link count %u disagrees with directory refs %u",
+                           i, ctx->inodes[i].links, ctx->dir_refs[i]);
+        }
+    }
+}
+
+// Scrubs the unit starting at block_index and returns the next block to visit.
+static uint32_t scrub_block(struct scrub_ctx *ctx, uint32_t block_index) {
+    if (block_index == 0) {
+        scrub_superblock(ctx);
+        stats.meta_blocks++;
+        return 1;
+    }
+    if (block_index < INODE_BMAP_IDX) {
+        scrub_journal(ctx);
+        stats.meta_blocks += JOURNAL_BLOCKS;
+        return INODE_BMAP_IDX;
+    }
+    if (block_index < INODE_START_IDX) {
+        scrub_bitmap(ctx, block_index);
+        stats.meta_blocks++;
+        return block_index + 1;
+    }
+    if (block_index < DATA_START_IDX) {
+        scrub_inode_block(ctx, block_index);
+        stats.meta_blocks++;
+        return block_index + 1;
+    }
+    scrub_data_block(ctx, block_index);
+    stats.data_blocks++;
+    return block_index + 1;
+}
+
+/* -------------------- state file -------------------- */
+
+static void load_state(const char *path, struct scrub_state *st) {
+    memset(st, 0, sizeof(*st));
+    st->magic = SCRUB_MAGIC;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct scrub_state disk;
+    if (read(fd, &disk, sizeof(disk)) == (ssize_t)sizeof(disk) && disk.magic == SCRUB_MAGIC &&
+        disk.cursor < TOTAL_BLOCKS) {
+        *st = disk;
+    }
+    close(fd);
+}
+
+static void save_state(const char *path, const struct scrub_state *st) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        die("open scrub state");
+    }
+    if (write(fd, st, sizeof(*st)) != (ssize_t)sizeof(*st)) {
+        die("write scrub state");
+    }
+    if (close(fd) < 0) {
+        die("close scrub state");
+    }
+    if (rename(tmp, path) < 0) {
+        die("rename scrub state");
+    }
+}
+
+static void print_progress(const struct scrub_state *st, uint32_t cursor) {
+    fprintf(stderr, "scrub: pass %llu block %u/%u (%u%%), %llu finding(s) this run\n",
+            (unsigned long long)st->passes + 1, cursor, TOTAL_BLOCKS,
+            cursor * 100U / TOTAL_BLOCKS, (unsigned long long)stats.findings);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [image] [--rate <blocks/s>] [--max-blocks <n>] [--loop <seconds>] [--reset]\n"
+            "  --rate        cap block reads per second (default: unthrottled)\n"
+            "  --max-blocks  stop after scrubbing n blocks; the next run resumes there\n"
+            "  --loop        keep scrubbing, sleeping the given seconds between passes\n"
+            "  --reset       forget the saved cursor and start a fresh pass\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *image_path = DEFAULT_IMAGE;
+    uint64_t max_blocks = 0;
+    long loop_interval = -1;
+    int reset = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            rate_limit = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--max-blocks") == 0 && i + 1 < argc) {
+            max_blocks = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--loop") == 0 && i + 1 < argc) {
+            loop_interval = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--reset") == 0) {
+            reset = 1;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            image_path = argv[i];
+        }
+    }
+
+    struct scrub_ctx *ctx = malloc(sizeof(*ctx));
+    if (!ctx) {
+        die("malloc scrub context");
+    }
+    ctx->dev = bdev_open(image_path, BDEV_RDONLY, 0);
+    if (!ctx->dev) {
+        die("open");
+    }
+
+    char state_path[4096];
+    snprintf(state_path, sizeof(state_path), "%s.scrub", image_path);
+    struct scrub_state st;
+    load_state(state_path, &st);
+    if (reset) {
+        st.cursor = 0;
+    }
+    // With --loop, each pass folds its counts into st; the run's own are the
+    // difference.
+    const uint64_t findings_before = st.findings, read_errors_before = st.read_errors;
+
+    struct timespec run_start, last_progress;
+    clock_gettime(CLOCK_MONOTONIC, &run_start);
+    budget_start = run_start;
+    last_progress = run_start;
+
+    uint64_t scrubbed = 0;   // this pass, for --max-blocks
+    uint64_t run_blocks = 0; // every pass; stats also count the whole run
+    uint32_t cursor = st.cursor;
+    int pass_from_start = (cursor == 0);
+    load_ctx(ctx);
+
+    for (;;) {
+        uint32_t next = scrub_block(ctx, cursor);
+        scrubbed += next - cursor;
+        cursor = next;
+
+        if (elapsed_ns(&last_progress) >= PROGRESS_INTERVAL * 1000000000ULL) {
+            print_progress(&st, cursor);
+            clock_gettime(CLOCK_MONOTONIC, &last_progress);
+        }
+
+        if (cursor >= TOTAL_BLOCKS) {
+            if (pass_from_start) {
+                scrub_link_counts(ctx);
+            }
+            st.passes++;
+            st.last_pass_end = (uint64_t)time(NULL);
+            cursor = 0;
+            pass_from_start = 1;
+            if (loop_interval < 0) {
+                break;
+            }
+            st.cursor = cursor;
+            st.blocks += scrubbed;
+            st.findings += stats.findings;
+            st.read_errors += stats.read_errors;
+            save_state(state_path, &st);
+            run_blocks += scrubbed;
+            scrubbed = 0;
+            stats.findings = 0;
+            stats.read_errors = 0;
+            sleep((unsigned)loop_interval);
+            // Reset the budget so an idle interval is not spent as burst credit.
+            clock_gettime(CLOCK_MONOTONIC, &budget_start);
+            budget_reads = 0;
+            load_ctx(ctx);
+            continue;
+        }
+        if (max_blocks != 0 && scrubbed >= max_blocks) {
+            break;
+        }
+    }
+
+    st.cursor = cursor;
+    st.blocks += scrubbed;
+    st.findings += stats.findings;
+    st.read_errors += stats.read_errors;
+    save_state(state_path, &st);
+    run_blocks += scrubbed;
+
+    double secs = (double)elapsed_ns(&run_start) / 1e9;
+    printf("scrub: '%s' %llu block(s) (%llu metadata, %llu data), %llu read(s), %.2fs, %.0f blocks/s, "
+           "throttled %.2fs\n",
+           image_path, (unsigned long long)run_blocks, (unsigned long long)stats.meta_blocks,
+           (unsigned long long)stats.data_blocks, (unsigned long long)stats.reads, secs,
+           secs > 0 ? (double)run_blocks / secs : 0.0, (double)stats.throttled_ns / 1e9);
+    printf("scrub: %llu finding(s), %llu read error(s) this run; %llu pass(es), %llu finding(s) lifetime; "
+           "next block %u\n",
+           (unsigned long long)(st.findings - findings_before),
+           (unsigned long long)(st.read_errors - read_errors_before), (unsigned long long)st.passes,
+           (unsigned long long)st.findings, st.cursor);
+
+    bdev_close(ctx->dev);
+    int found = st.findings != findings_before;
+    free(ctx);
+    return found ? 1 : 0;
+}
@@ -0,0 +1,347 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SHARDS 256U
+#define SHARD_FMT  "%s/shard-%03u.img"
+
+// One image of the set and the worker thread that owns it. Every command on a
+// shard runs in its worker, so operations on one image stay in input order
+// while different images proceed in parallel.
+struct shard {
+    unsigned idx;
+    char path[4096];
+    const char **names; // creates routed to this shard, in input order
+    unsigned nnames;
+    unsigned created;
+    unsigned failed;
+    unsigned checkpoints;
+    int status; // exit status of install/validate
+    double secs;
+};
+
+struct shard_set {
+    const char *dir;
+    const char *bin;
+    struct shard shards[MAX_SHARDS];
+    unsigned n;
+};
+
+static void die(const char *msg) {
+    perror(msg);
+    exit(2);
+}
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// FNV-1a: stable across hosts and builds, so a name always maps to the same
+// image for a given shard count.
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261U;
+    for (const unsigned char *p = (const unsigned char *)name; *p; ++p) {
+        h ^= *p;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static unsigned shard_of(const struct shard_set *set, const char *name) {
+    return name_hash(name) % set->n;
+}
+
+// Runs a tool with its output discarded; returns its exit status.
+static int run_tool(const char *bin, const char *tool, char *const args[]) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", bin, tool);
+    pid_t pid = fork();
+    if (pid < 0) {
+        die("fork");
+    }
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+        }
+        execv(path, args);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        die("waitpid");
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static int run_journal(const struct shard_set *set, struct shard *sh, const char *cmd, const char *arg) {
+    char *args[] = {"journal", "-f", sh->path, (char *)cmd, (char *)arg, NULL};
+    return run_tool(set->bin, "journal", args);
+}
+
+// The shard count is the number of consecutive shard-NNN.img files.
+static void open_set(struct shard_set *set, const char *dir) {
+    set->dir = dir;
+    set->n = 0;
+    for (unsigned i = 0; i < MAX_SHARDS; ++i) {
+        struct shard *sh = &set->shards[i];
+        snprintf(sh->path, sizeof(sh->path), SHARD_FMT, dir, i);
+        if (access(sh->path, F_OK) != 0) {
+            break;
+        }
+        sh->idx = i;
+        set->n++;
+    }
+    if (set->n == 0) {
+        fprintf(stderr, "shard: no shard-000.img in '%s'; run shard init first\n", dir);
+        exit(2);
+    }
+}
+
+typedef void (*shard_fn)(const struct shard_set *set, struct shard *sh);
+
+struct worker_arg {
+    const struct shard_set *set;
+    struct shard *sh;
+    shard_fn fn;
+};
+
+static void *worker_main(void *p) {
+    struct worker_arg *wa = p;
+    double start = now_secs();
+    wa->fn(wa->set, wa->sh);
+    wa->sh->secs = now_secs() - start;
+    return NULL;
+}
+
+// Runs fn on every shard, one worker thread per image.
+static void for_each_shard(struct shard_set *set, shard_fn fn) {
+    pthread_t tids[MAX_SHARDS];
+    struct worker_arg args[MAX_SHARDS];
+    for (unsigned i = 0; i < set->n; ++i) {
+        args[i] = (struct worker_arg){set, &set->shards[i], fn};
+        if (pthread_create(&tids[i], NULL, worker_main, &args[i]) != 0) {
+            die("pthread_create");
+        }
+    }
+    for (unsigned i = 0; i < set->n; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+/* -------------------- commands -------------------- */
+
+static int cmd_init(const char *dir, const char *bin, unsigned n) {
+    if (n == 0 || n > MAX_SHARDS) {
+        fprintf(stderr, "shard: shard count must be 1..%u\n", MAX_SHARDS);
+        return 2;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        die(dir);
+    }
+    char path[4096];
+    snprintf(path, sizeof(path), SHARD_FMT, dir, 0U);
+    if (access(path, F_OK) == 0) {
+        fprintf(stderr, "shard: '%s' already holds a shard set\n", dir);
+        return 2;
+    }
+    for (unsigned i = 0; i < n; ++i) {
+        snprintf(path, sizeof(path), SHARD_FMT, dir, i);
+        char *args[] = {"mkfs", path, NULL};
+        if (run_tool(bin, "mkfs", args) != 0) {
+            fprintf(stderr, "shard: mkfs '%s' failed\n", path);
+            return 2;
+        }
+    }
+    printf("shard: initialized %u image(s) in '%s'\n", n, dir);
+    return 0;
+}
+
+// A create that fails is retried once after a checkpoint, since a full
+// journal is the common cause; a second failure (name taken, image full)
+// is reported.
+static void create_worker(const struct shard_set *set, struct shard *sh) {
+    for (unsigned i = 0; i < sh->nnames; ++i) {
+        if (run_journal(set, sh, "create", sh->names[i]) == 0) {
+            sh->created++;
+            continue;
+        }
+        if (run_journal(set, sh, "install", NULL) == 0) {
+            sh->checkpoints++;
+        }
+        if (run_journal(set, sh, "create", sh->names[i]) == 0) {
+            sh->created++;
+        } else {
+            sh->failed++;
+            fprintf(stderr, "shard %u: create '%s' failed\n", sh->idx, sh->names[i]);
+        }
+    }
+}
+
+static void install_worker(const struct shard_set *set, struct shard *sh) {
+    sh->status = run_journal(set, sh, "install", NULL);
+}
+
+static void validate_worker(const struct shard_set *set, struct shard *sh) {
+    char *args[] = {"validator", sh->path, NULL};
+    sh->status = run_tool(set->bin, "validator", args);
+}
+
+static int cmd_create(struct shard_set *set, const char **names, unsigned nnames) {
+    unsigned *route = malloc((nnames ? nnames : 1) * sizeof(*route));
+    const char **slots = malloc((nnames ? nnames : 1) * sizeof(*slots));
+    if (!route || !slots) {
+        die("malloc");
+    }
+    unsigned counts[MAX_SHARDS] = {0};
+    for (unsigned i = 0; i < nnames; ++i) {
+        route[i] = shard_of(set, names[i]);
+        counts[route[i]]++;
+    }
+    // Carve one contiguous slice of slots per shard.
+    unsigned off = 0;
+    for (unsigned s = 0; s < set->n; ++s) {
+        set->shards[s].names = slots + off;
+        set->shards[s].nnames = 0;
+        off += counts[s];
+    }
+    for (unsigned i = 0; i < nnames; ++i) {
+        struct shard *sh = &set->shards[route[i]];
+        sh->names[sh->nnames++] = names[i];
+    }
+
+    double start = now_secs();
+    for_each_shard(set, create_worker);
+    double secs = now_secs() - start;
+
+    unsigned created = 0, failed = 0, checkpoints = 0;
+    for (unsigned s = 0; s < set->n; ++s) {
+        const struct shard *sh = &set->shards[s];
+        printf("shard %3u: %u created, %u failed, %u checkpoint(s), %.3fs\n", sh->idx, sh->created,
+               sh->failed, sh->checkpoints, sh->secs);
+        created += sh->created;
+        failed += sh->failed;
+        checkpoints += sh->checkpoints;
+    }
+    printf("shard: %u created, %u failed, %u checkpoint(s) across %u image(s) in %.3fs (%.0f creates/s)\n",
+           created, failed, checkpoints, set->n, secs, secs > 0 ? created / secs : 0.0);
+    free(route);
+    free(slots);
+    return failed ? 1 : 0;
+}
+
+static int cmd_each(struct shard_set *set, shard_fn fn, const char *verb, const char *ok) {
+    double start = now_secs();
+    for_each_shard(set, fn);
+    double secs = now_secs() - start;
+    unsigned bad = 0;
+    for (unsigned s = 0; s < set->n; ++s) {
+        const struct shard *sh = &set->shards[s];
+        if (sh->status == 0) {
+            printf("%s: %s\n", sh->path, ok);
+        } else {
+            printf("%s: %s FAILED (exit %d)\n", sh->path, verb, sh->status);
+            bad++;
+        }
+    }
+    printf("shard: %s %u/%u image(s) ok in %.3fs\n", verb, set->n - bad, set->n, secs);
+    return bad ? 1 : 0;
+}
+
+// Names from stdin, one per line, when none are given on the command line.
+static const char **read_names(unsigned *count) {
+    size_t cap = 64, n = 0;
+    const char **names = malloc(cap * sizeof(*names));
+    char line[256];
+    if (!names) {
+        die("malloc");
+    }
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0]) {
+            continue;
+        }
+        if (n == cap) {
+            cap *= 2;
+            names = realloc(names, cap * sizeof(*names));
+            if (!names) {
+                die("realloc");
+            }
+        }
+        names[n] = strdup(line);
+        if (!names[n]) {
+            die("strdup");
+        }
+        n++;
+    }
+    *count = (unsigned)n;
+    return names;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [--bin dir] <command> <dir> ...\n"
+            "  init <dir> <n>            create n empty images, shard-000.img ...\n"
+            "  create <dir> [name ...]   create files (names from stdin if none given)\n"
+            "  install <dir>             checkpoint every image\n"
+            "  validate <dir>            validate every image\n"
+            "  which <dir> <name>        print the image a name maps to\n"
+            "  --bin   directory holding mkfs, journal and validator (default .)\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *bin = ".";
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "--bin") == 0) {
+        bin = argv[i + 1];
+        i += 2;
+    }
+    if (argc - i < 2) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char *cmd = argv[i], *dir = argv[i + 1];
+    char **rest = argv + i + 2;
+    int nrest = argc - i - 2;
+
+    if (strcmp(cmd, "init") == 0) {
+        if (nrest != 1) {
+            usage(argv[0]);
+            return 2;
+        }
+        return cmd_init(dir, bin, (unsigned)strtoul(rest[0], NULL, 10));
+    }
+
+    static struct shard_set set;
+    set.bin = bin;
+    open_set(&set, dir);
+    if (strcmp(cmd, "create") == 0) {
+        unsigned n = (unsigned)nrest;
+        const char **names = nrest ? (const char **)rest : read_names(&n);
+        return cmd_create(&set, names, n);
+    }
+    if (strcmp(cmd, "install") == 0 && nrest == 0) {
+        return cmd_each(&set, install_worker, "install", "installed");
+    }
+    if (strcmp(cmd, "validate") == 0 && nrest == 0) {
+        return cmd_each(&set, validate_worker, "validate", "consistent");
+    }
+    if (strcmp(cmd, "which") == 0 && nrest == 1) {
+        printf("%s\n", set.shards[shard_of(&set, rest[0])].path);
+        return 0;
+    }
+    usage(argv[0]);
+    return 2;
+}
@@ -1,12 +1,18 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "blockdev.h"
+
 #define FS_MAGIC 0x56534653U
 
 #define BLOCK_SIZE        4096U
@@ -21,8 +27,18 @@
 #define DATA_START_IDX     (INODE_START_IDX + INODE_BLOCKS)
 #define TOTAL_BLOCKS       (DATA_START_IDX + DATA_BLOCKS)
 #define DIRECT_POINTERS     8U
+#define JOURNAL_MAGIC       0xdeadbeefU
+#define JOURNAL_BYTES       (JOURNAL_BLOCKS * BLOCK_SIZE)
+#define REC_DATA            1U
+#define REC_COMMIT          2U
+#define REC_PAD             3U                     // space skipped by compaction
+#define DATA_REC_SIZE       (8U + 4U + BLOCK_SIZE) // header, target block, image
+#define COMMIT_REC_SIZE     (8U + 8U)              // header, sequence number, time
+#define LIVE_RETRIES        100
 #define DEFAULT_IMAGE "vsfs.img"
 
+#define FS_STATE_CLEAN 0x1U // journal is empty; set by install, cleared by create
+
 struct superblock {
     uint32_t magic;
     uint32_t block_size;
@@ -35,7 +51,11 @@ struct superblock {
     uint32_t inode_start;
     uint32_t data_start;
 
-    uint8_t  _pad[128 - 9 * 4];
+    uint32_t state;
+    uint32_t checkpoint_seq;
+    uint32_t install_gen;
+
+    uint8_t  _pad[128 - 12 * 4];
 };
 
 struct inode {
@@ -60,99 +80,149 @@ _Static_assert(sizeof(struct superblock) == 128, "superblock must be 128 bytes")
 _Static_assert(sizeof(struct inode) == 128, "inode must be 128 bytes");
 _Static_assert(sizeof(struct dirent) == 32, "dirent must be 32 bytes");
 
-static int error_count = 0;
+#define MAX_INODES (INODE_BLOCKS * (BLOCK_SIZE / INODE_SIZE))
+#define MAX_IMAGES 65536
+
+// Scratch space for checking one image. A fleet worker allocates it once and
+// reuses it for every image it checks.
+struct vbufs {
+    uint8_t *live_image; // TOTAL_BLOCKS blocks, --live only
+    uint8_t inode_area[INODE_BLOCKS * BLOCK_SIZE];
+    uint8_t block[BLOCK_SIZE];
+    uint8_t inode_used[MAX_INODES];
+    uint32_t link_refs[MAX_INODES];
+};
+
+// Everything known about the image being checked; nothing carries over to
+// the next one.
+struct vctx {
+    const char *path;
+    blockdev_t *dev;
+    struct vbufs *bufs;
+    const uint8_t *live_image; // set in --live mode; reads are served from it
+    int error_count;
+    int unreadable;
+    FILE *out; // progress notes and the verdict
+    FILE *err; // ERROR lines
+};
 
 static void die(const char *msg) {
     perror(msg);
     exit(EXIT_FAILURE);
 }
 
-static void report_error(const char *fmt, ...) {
+static void report_error(struct vctx *vc, const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    fputs("ERROR: ", stderr);
-    vfprintf(stderr, fmt, ap);
-    fputc('\n', stderr);
+    fputs("ERROR: ", vc->err);
+    vfprintf(vc->err, fmt, ap);
+    fputc('\n', vc->err);
     va_end(ap);
-    error_count++;
+    vc->error_count++;
 }
 
-static void pread_block(int fd, uint32_t block_index, void *buf) {
-    off_t offset = (off_t)block_index * BLOCK_SIZE;
-    ssize_t n = pread(fd, buf, BLOCK_SIZE, offset);
-    if (n != (ssize_t)BLOCK_SIZE) {
-        die("pread");
+// A failed read makes the image unreadable; the caller stops checking it.
+static int pread_block(struct vctx *vc, uint32_t block_index, void *buf) {
+    if (vc->live_image) {
+        if (block_index >= TOTAL_BLOCKS) {
+            errno = ENXIO;
+        } else {
+            memcpy(buf, vc->live_image + (size_t)block_index * BLOCK_SIZE, BLOCK_SIZE);
+            return 0;
+        }
+    } else if (bdev_read(vc->dev, block_index, buf) == 0) {
+        return 0;
     }
+    fprintf(vc->err, "ERROR: cannot read block %u: %s\n", block_index, strerror(errno));
+    vc->unreadable = 1;
+    return -1;
 }
 
 static int bitmap_test(const uint8_t *bitmap, uint32_t index) {
     return (bitmap[index / 8] >> (index % 8)) & 0x1;
 }
 
-static void bitmap_check_zero_tail(const uint8_t *bitmap, uint32_t valid_bits, const char *name) {
+static void bitmap_check_zero_tail(struct vctx *vc, const uint8_t *bitmap, uint32_t valid_bits, const char *name) {
     uint32_t total_bits = BLOCK_SIZE * 8;
     for (uint32_t bit = valid_bits; bit < total_bits; ++bit) {
         if (bitmap_test(bitmap, bit)) {
-            report_error("%s bitmap has stray bit set at %u", name, bit);
+            report_error(vc, "%s bitmap has stray bit set at %u", name, bit);
             return;
         }
     }
 }
 
-static void validate_superblock(const struct superblock *sb) {
+static void validate_superblock(struct vctx *vc, const struct superblock *sb) {
     if (sb->magic != FS_MAGIC) {
-        report_error("invalid superblock magic 0x%08x", sb->magic);
+        report_error(vc, "invalid superblock magic 0x%08x", sb->magic);
     }
     if (sb->block_size != BLOCK_SIZE) {
-        report_error("unexpected block size %u", sb->block_size);
+        report_error(vc, "unexpected block size %u", sb->block_size);
     }
     if (sb->total_blocks != TOTAL_BLOCKS) {
-        report_error("unexpected total blocks %u", sb->total_blocks);
+        report_error(vc, "unexpected total blocks %u", sb->total_blocks);
     }
-    uint32_t expected_inodes = INODE_BLOCKS * (BLOCK_SIZE / INODE_SIZE);
-    if (sb->inode_count != expected_inodes) {
-        report_error("unexpected inode count %u", sb->inode_count);
+    if (sb->inode_count != MAX_INODES) {
+        report_error(vc, "unexpected inode count %u", sb->inode_count);
     }
     if (sb->journal_block != JOURNAL_BLOCK_IDX) {
-        report_error("journal block index mismatch %u", sb->journal_block);
+        report_error(vc, "journal block index mismatch %u", sb->journal_block);
     }
     if (sb->inode_bitmap != INODE_BMAP_IDX) {
-        report_error("inode bitmap index mismatch %u", sb->inode_bitmap);
+        report_error(vc, "inode bitmap index mismatch %u", sb->inode_bitmap);
     }
     if (sb->data_bitmap != DATA_BMAP_IDX) {
-        report_error("data bitmap index mismatch %u", sb->data_bitmap);
+        report_error(vc, "data bitmap index mismatch %u", sb->data_bitmap);
     }
     if (sb->inode_start != INODE_START_IDX) {
-        report_error("inode start index mismatch %u", sb->inode_start);
+        report_error(vc, "inode start index mismatch %u", sb->inode_start);
     }
     if (sb->data_start != DATA_START_IDX) {
-        report_error("data start index mismatch %u", sb->data_start);
+        report_error(vc, "data start index mismatch %u", sb->data_start);
+    }
+    if (sb->state & ~FS_STATE_CLEAN) {
+        report_error(vc, "unknown superblock state bits 0x%08x", sb->state);
+    }
+}
+
+// Only consulted when the image was not cleanly checkpointed: the home
+// locations are then validated as-is, but pending work is worth a mention.
+static void note_pending_journal(struct vctx *vc) {
+    uint32_t header[BLOCK_SIZE / sizeof(uint32_t)];
+    if (pread_block(vc, JOURNAL_BLOCK_IDX, header) != 0) {
+        return;
+    }
+    if (header[0] == JOURNAL_MAGIC && header[1] > 2 * sizeof(uint32_t)) {
+        fprintf(vc->out, "note: journal holds %u byte(s) of uninstalled records; run ./journal install\n",
+                header[1] - (uint32_t)(2 * sizeof(uint32_t)));
     }
 }
 
-static void check_directory(int fd,
+static void check_directory(struct vctx *vc,
                             const struct inode *inode,
                             uint32_t inode_index,
                             const uint8_t *inode_used,
                             uint32_t inode_count,
                             uint32_t *link_refs) {
     if (inode->size % sizeof(struct dirent) != 0) {
-        report_error("inode %u directory size %u is not dirent-aligned", inode_index, inode->size);
+        report_error(vc, "inode %u directory size %u is not dirent-aligned", inode_index, inode->size);
         return;
     }
 
     uint32_t bytes_remaining = inode->size;
-    uint8_t block[BLOCK_SIZE];
+    uint8_t *block = vc->bufs->block;
     int saw_dot = 0;
     int saw_dotdot = 0;
 
     for (uint32_t i = 0; i < DIRECT_POINTERS && bytes_remaining > 0; ++i) {
         uint32_t blk = inode->direct[i];
         if (blk == 0) {
-            report_error("inode %u directory missing data block for bytes still remaining", inode_index);
+            report_error(vc, "inode %u directory missing data block for bytes still remaining", inode_index);
+            return;
+        }
+        if (pread_block(vc, blk, block) != 0) {
             return;
         }
-        pread_block(fd, blk, block);
         uint32_t chunk = bytes_remaining > BLOCK_SIZE ? BLOCK_SIZE : bytes_remaining;
         uint32_t entries = chunk / sizeof(struct dirent);
         const struct dirent *entries_ptr = (const struct dirent *)block;
@@ -162,24 +232,24 @@ static void check_directory(int fd,
                 continue;
             }
             if (de->inode >= inode_count) {
-                report_error("inode %u directory entry points to out-of-range inode %u", inode_index, de->inode);
+                report_error(vc, "inode %u directory entry points to out-of-range inode %u", inode_index, de->inode);
                 continue;
             }
             if (!inode_used[de->inode]) {
-                report_error("inode %u directory entry references free inode %u", inode_index, de->inode);
+                report_error(vc, "inode %u directory entry references free inode %u", inode_index, de->inode);
             }
             if (memchr(de->name, '\0', sizeof(de->name)) == NULL) {
-                report_error("inode %u directory entry has unterminated name", inode_index);
+                report_error(vc, "inode %u directory entry has unterminated name", inode_index);
                 continue;
             }
             if (de->name[0] == '\0') {
-                report_error("inode %u directory entry has empty name", inode_index);
+                report_error(vc, "inode %u directory entry has empty name", inode_index);
                 continue;
             }
             link_refs[de->inode]++;
             if (strcmp(de->name, ".") == 0) {
                 if (de->inode != inode_index) {
-                    report_error("inode %u '.' entry points to %u", inode_index, de->inode);
+                    report_error(vc, "inode %u '.' entry points to %u", inode_index, de->inode);
                 }
                 saw_dot = 1;
             } else if (strcmp(de->name, "..") == 0) {
@@ -190,54 +260,152 @@ static void check_directory(int fd,
     }
 
     if (bytes_remaining != 0) {
-        report_error("inode %u directory uses more data than direct pointers cover", inode_index);
+        report_error(vc, "inode %u directory uses more data than direct pointers cover", inode_index);
     }
     if (inode->size > 0) {
         if (!saw_dot) {
-            report_error("inode %u directory missing '.' entry", inode_index);
+            report_error(vc, "inode %u directory missing '.' entry", inode_index);
         }
         if (!saw_dotdot) {
-            report_error("inode %u directory missing '..' entry", inode_index);
+            report_error(vc, "inode %u directory missing '..' entry", inode_index);
         }
     }
 }
 
-int main(int argc, char *argv[]) {
-    const char *image_path = (argc > 1) ? argv[1] : DEFAULT_IMAGE;
+// Folds committed journal transactions into the in-memory image, the same
+// way ./journal install would write them to home locations.
+static uint32_t replay_journal(uint8_t *image) {
+    const uint8_t *jbuf = image + (size_t)JOURNAL_BLOCK_IDX * BLOCK_SIZE;
+    uint32_t magic, end, last_seq = 0;
+    memcpy(&magic, jbuf, sizeof(magic));
+    memcpy(&end, jbuf + 4, sizeof(end));
+    if (magic != JOURNAL_MAGIC || end > JOURNAL_BYTES) {
+        return 0;
+    }
 
-    int fd = open(image_path, O_RDONLY);
-    if (fd < 0) {
-        die("open");
+    uint32_t pending[JOURNAL_BYTES / DATA_REC_SIZE];
+    uint32_t pending_cnt = 0;
+    uint32_t off = 8;
+    while (off + 8 <= end) {
+        uint32_t type, size;
+        memcpy(&type, jbuf + off, sizeof(type));
+        memcpy(&size, jbuf + off + 4, sizeof(size));
+        if (size > end - off) {
+            break;
+        }
+        if (type == REC_DATA && size == DATA_REC_SIZE) {
+            pending[pending_cnt++] = off;
+        } else if (type == REC_COMMIT && size == COMMIT_REC_SIZE) {
+            for (uint32_t i = 0; i < pending_cnt; ++i) {
+                uint32_t target;
+                memcpy(&target, jbuf + pending[i] + 8, sizeof(target));
+                // Never let a record clobber the journal being replayed.
+                if (target >= INODE_BMAP_IDX && target < TOTAL_BLOCKS) {
+                    memcpy(image + (size_t)target * BLOCK_SIZE, jbuf + pending[i] + 12, BLOCK_SIZE);
+                }
+            }
+            memcpy(&last_seq, jbuf + off + 8, sizeof(last_seq));
+            pending_cnt = 0;
+        } else if (type == REC_PAD && size >= 8 && size <= JOURNAL_BYTES && pending_cnt == 0) {
+            // nothing to replay
+        } else {
+            break;
+        }
+        off += size;
     }
+    return last_seq;
+}
 
+// Builds a consistent in-memory snapshot of an image that may be in use:
+// creates only append to the journal, so home blocks plus committed records
+// are a consistent state; a concurrent install is caught by install_gen.
+static int load_live_image(struct vctx *vc) {
+    if (!vc->bufs->live_image) {
+        vc->bufs->live_image = malloc((size_t)TOTAL_BLOCKS * BLOCK_SIZE);
+        if (!vc->bufs->live_image) {
+            die("malloc live image");
+        }
+    }
+    uint8_t *image = vc->bufs->live_image;
+    for (int attempt = 0; attempt < LIVE_RETRIES; ++attempt) {
+        struct superblock before, after;
+        if (pread_block(vc, 0, image) != 0) {
+            return -1;
+        }
+        memcpy(&before, image, sizeof(before));
+        if (before.install_gen & 1U) {
+            usleep(1000);
+            continue;
+        }
+        // Block order matters: the journal header is read before its records.
+        for (uint32_t b = 1; b < TOTAL_BLOCKS; ++b) {
+            if (pread_block(vc, b, image + (size_t)b * BLOCK_SIZE) != 0) {
+                return -1;
+            }
+        }
+        uint32_t seq = before.checkpoint_seq;
+        if (!(before.state & FS_STATE_CLEAN)) {
+            uint32_t journal_seq = replay_journal(image);
+            if (journal_seq > seq) {
+                seq = journal_seq;
+            }
+        }
+        if (pread_block(vc, 0, vc->bufs->block) != 0) {
+            return -1;
+        }
+        memcpy(&after, vc->bufs->block, sizeof(after));
+        if (after.install_gen == before.install_gen) {
+            fprintf(vc->out, "Validating live snapshot as of seq %u.\n", seq);
+            vc->live_image = image;
+            return 0;
+        }
+    }
+    fprintf(vc->err, "ERROR: could not take a stable snapshot (install in progress or interrupted)\n");
+    vc->unreadable = 1;
+    return -1;
+}
+
+static void check_image(struct vctx *vc, int live) {
+    struct vbufs *bufs = vc->bufs;
+    if (live && load_live_image(vc) != 0) {
+        return;
+    }
+
+    uint8_t sb_block[BLOCK_SIZE];
     struct superblock sb;
-    pread_block(fd, 0, &sb);
-    validate_superblock(&sb);
+    if (pread_block(vc, 0, sb_block) != 0) {
+        return;
+    }
+    memcpy(&sb, sb_block, sizeof(sb));
+    validate_superblock(vc, &sb);
+    if (!live && !(sb.state & FS_STATE_CLEAN)) {
+        note_pending_journal(vc);
+        if (vc->unreadable) {
+            return;
+        }
+    }
 
     uint8_t inode_bitmap[BLOCK_SIZE];
     uint8_t data_bitmap[BLOCK_SIZE];
-    pread_block(fd, INODE_BMAP_IDX, inode_bitmap);
-    pread_block(fd, DATA_BMAP_IDX, data_bitmap);
-
-    uint32_t inode_count = sb.inode_count;
-    uint32_t total_inode_bytes = INODE_BLOCKS * BLOCK_SIZE;
-    uint8_t *inode_area = malloc(total_inode_bytes);
-    if (!inode_area) {
-        die("malloc inode area");
+    if (pread_block(vc, INODE_BMAP_IDX, inode_bitmap) != 0 || pread_block(vc, DATA_BMAP_IDX, data_bitmap) != 0) {
+        return;
     }
+
+    // A corrupt count was reported above; never index past the table.
+    uint32_t inode_count = sb.inode_count < MAX_INODES ? sb.inode_count : MAX_INODES;
     for (uint32_t i = 0; i < INODE_BLOCKS; ++i) {
-        pread_block(fd, INODE_START_IDX + i, inode_area + (i * BLOCK_SIZE));
+        if (pread_block(vc, INODE_START_IDX + i, bufs->inode_area + (i * BLOCK_SIZE)) != 0) {
+            return;
+        }
     }
-    struct inode *inodes = (struct inode *)inode_area;
+    struct inode *inodes = (struct inode *)bufs->inode_area;
 
-    uint8_t inode_used[inode_count];
+    uint8_t *inode_used = bufs->inode_used;
     for (uint32_t i = 0; i < inode_count; ++i) {
         inode_used[i] = (inodes[i].type != 0);
     }
-    uint32_t *link_refs = calloc(inode_count, sizeof(uint32_t));
-    if (!link_refs) {
-        die("calloc link refs");
-    }
+    uint32_t *link_refs = bufs->link_refs;
+    memset(link_refs, 0, sizeof(bufs->link_refs));
 
     int data_owner[DATA_BLOCKS];
     memset(data_owner, -1, sizeof(data_owner));
@@ -249,7 +417,7 @@ int main(int argc, char *argv[]) {
         int allocated = ino->type != 0;
         int bitmap_bit = bitmap_test(inode_bitmap, i);
         if (allocated != bitmap_bit) {
-            report_error("inode %u allocation mismatch (inode vs bitmap)", i);
+            report_error(vc, "inode %u allocation mismatch (inode vs bitmap)", i);
         }
         inode_used[i] = allocated;
         if (!allocated) {
@@ -257,12 +425,12 @@ int main(int argc, char *argv[]) {
         }
 
         if (ino->type > 2) {
-            report_error("inode %u has invalid type %u", i, ino->type);
+            report_error(vc, "inode %u has invalid type %u", i, ino->type);
         }
 
         uint32_t required_blocks = (ino->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
         if (required_blocks > DIRECT_POINTERS) {
-            report_error("inode %u size %u exceeds direct pointers", i, ino->size);
+            report_error(vc, "inode %u size %u exceeds direct pointers", i, ino->size);
         }
 
         uint32_t seen_blocks = 0;
@@ -273,26 +441,29 @@ int main(int argc, char *argv[]) {
             }
             seen_blocks++;
             if (blk < DATA_START_IDX || blk >= DATA_START_IDX + DATA_BLOCKS) {
-                report_error("inode %u points outside data region (block %u)", i, blk);
+                report_error(vc, "inode %u points outside data region (block %u)", i, blk);
                 continue;
             }
             uint32_t data_idx = blk - DATA_START_IDX;
             if (data_owner[data_idx] != -1 && data_owner[data_idx] != (int)i) {
-                report_error("data block %u referenced by both inode %d and inode %u", blk, data_owner[data_idx], i);
+                report_error(vc, "data block %u referenced by both inode %d and inode %u", blk, data_owner[data_idx], i);
             }
             data_owner[data_idx] = (int)i;
             data_blocks_referenced[data_idx] = 1;
         }
 
         if (seen_blocks < required_blocks) {
-            report_error("inode %u lacks blocks for declared size (need %u have %u)", i, required_blocks, seen_blocks);
+            report_error(vc, "inode %u lacks blocks for declared size (need %u have %u)", i, required_blocks, seen_blocks);
         }
         if (required_blocks == 0 && seen_blocks > 0) {
-            report_error("inode %u has data blocks but zero size", i);
+            report_error(vc, "inode %u has data blocks but zero size", i);
         }
 
         if (ino->type == 2) {
-            check_directory(fd, ino, i, inode_used, inode_count, link_refs);
+            check_directory(vc, ino, i, inode_used, inode_count, link_refs);
+            if (vc->unreadable) {
+                return;
+            }
         }
     }
 
@@ -301,42 +472,235 @@ int main(int argc, char *argv[]) {
             continue;
         }
         if (inodes[i].links != link_refs[i]) {
-            report_error("inode %u link count %u disagrees with directory refs %u", i, inodes[i].links, link_refs[i]);
+            report_error(vc, "inode %u link count %u disagrees with directory refs %u", i, inodes[i].links, link_refs[i]);
         }
     }
 
     for (uint32_t bit = 0; bit < inode_count; ++bit) {
         int bit_val = bitmap_test(inode_bitmap, bit);
         if (bit_val && !inode_used[bit]) {
-            report_error("inode bitmap marks %u used but inode is free", bit);
+            report_error(vc, "inode bitmap marks %u used but inode is free", bit);
         }
         if (!bit_val && inode_used[bit]) {
-            report_error("inode bitmap misses allocated inode %u", bit);
+            report_error(vc, "inode bitmap misses allocated inode %u", bit);
         }
     }
-    bitmap_check_zero_tail(inode_bitmap, inode_count, "inode");
+    bitmap_check_zero_tail(vc, inode_bitmap, inode_count, "inode");
 
     for (uint32_t bit = 0; bit < DATA_BLOCKS; ++bit) {
         int bit_val = bitmap_test(data_bitmap, bit);
         if (bit_val && !data_blocks_referenced[bit]) {
-            report_error("data bitmap marks block %u used but no inode references it", bit + DATA_START_IDX);
+            report_error(vc, "data bitmap marks block %u used but no inode references it", bit + DATA_START_IDX);
         }
         if (!bit_val && data_blocks_referenced[bit]) {
-            report_error("data block %u referenced but bitmap is clear", bit + DATA_START_IDX);
+            report_error(vc, "data block %u referenced but bitmap is clear", bit + DATA_START_IDX);
         }
     }
 
-    bitmap_check_zero_tail(data_bitmap, DATA_BLOCKS, "data");
+    bitmap_check_zero_tail(vc, data_bitmap, DATA_BLOCKS, "data");
+}
 
-    if (close(fd) < 0) {
-        die("close");
+// Opens, checks and closes one image. Returns 0 if consistent, 1 if
+// inconsistent, 2 if it could not be read.
+static int validate_image(struct vctx *vc, int live) {
+    vc->dev = bdev_open(vc->path, BDEV_RDONLY, 0);
+    if (!vc->dev) {
+        fprintf(vc->err, "ERROR: cannot open '%s': %s\n", vc->path, strerror(errno));
+        return 2;
+    }
+    check_image(vc, live);
+    bdev_close(vc->dev);
+    vc->dev = NULL;
+    vc->live_image = NULL;
+    if (vc->unreadable) {
+        return 2;
     }
+    return vc->error_count ? 1 : 0;
+}
 
-    if (error_count == 0) {
-        printf("Filesystem '%s' is consistent.\n", image_path);
-        return 0;
+/* -------------------- fleet mode -------------------- */
+
+struct fleet {
+    char **paths;
+    uint32_t npaths;
+    int live;
+    uint32_t next; // next image to hand out, advanced atomically
+    uint32_t counts[3]; // consistent, inconsistent, unreadable
+    pthread_mutex_t print_lock;
+};
+
+// Each image's notes and errors are collected in memory and printed in one
+// piece, so concurrent checks never interleave their output.
+static void *fleet_worker(void *p) {
+    struct fleet *fl = p;
+    struct vbufs *bufs = calloc(1, sizeof(*bufs));
+    if (!bufs) {
+        die("calloc buffers");
+    }
+    char *text = NULL;
+    size_t text_len = 0;
+    for (;;) {
+        uint32_t i = __atomic_fetch_add(&fl->next, 1, __ATOMIC_RELAXED);
+        if (i >= fl->npaths) {
+            break;
+        }
+        FILE *log = open_memstream(&text, &text_len);
+        if (!log) {
+            die("open_memstream");
+        }
+        struct vctx vc = {.path = fl->paths[i], .bufs = bufs, .out = log, .err = log};
+        int rc = validate_image(&vc, fl->live);
+        fclose(log);
+
+        pthread_mutex_lock(&fl->print_lock);
+        fl->counts[rc]++;
+        if (rc == 0) {
+            printf("%s: consistent\n", vc.path);
+        } else if (rc == 1) {
+            printf("%s: %d inconsistencies\n", vc.path, vc.error_count);
+        } else {
+            printf("%s: unreadable\n", vc.path);
+        }
+        if (rc != 0 || text_len > 0) {
+            // Indent the details under the image's summary line.
+            for (char *line = text, *nl; line && *line; line = nl ? nl + 1 : NULL) {
+                nl = strchr(line, '\n');
+                printf("  %.*s\n", nl ? (int)(nl - line) : (int)strlen(line), line);
+            }
+        }
+        fflush(stdout);
+        pthread_mutex_unlock(&fl->print_lock);
+        free(text);
+        text = NULL;
+    }
+    free(bufs->live_image);
+    free(bufs);
+    return NULL;
+}
+
+// A directory argument stands for the *.img files directly inside it.
+static void add_path(struct fleet *fl, const char *arg) {
+    struct stat st;
+    if (stat(arg, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        if (fl->npaths == MAX_IMAGES) {
+            fprintf(stderr, "too many images (max %d)\n", MAX_IMAGES);
+            exit(EXIT_FAILURE);
+        }
+        fl->paths[fl->npaths++] = strdup(arg);
+        return;
+    }
+    char pattern[4096];
+    snprintf(pattern, sizeof(pattern), "%s/*.img", arg);
+    glob_t g;
+    if (glob(pattern, 0, NULL, &g) != 0) {
+        return; // no images in it
+    }
+    for (size_t i = 0; i < g.gl_pathc; ++i) {
+        if (fl->npaths == MAX_IMAGES) {
+            fprintf(stderr, "too many images (max %d)\n", MAX_IMAGES);
+            exit(EXIT_FAILURE);
+        }
+        fl->paths[fl->npaths++] = strdup(g.gl_pathv[i]);
     }
+    globfree(&g);
+}
 
-    fprintf(stderr, "%d inconsistencies found.\n", error_count);
+static int run_fleet(struct fleet *fl, int jobs) {
+    if (fl->npaths == 0) {
+        fprintf(stderr, "no images to validate\n");
+        return 1;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if ((uint32_t)jobs > fl->npaths) {
+        jobs = (int)fl->npaths;
+    }
+    pthread_mutex_init(&fl->print_lock, NULL);
+    pthread_t *tids = malloc((size_t)jobs * sizeof(*tids));
+    if (!tids) {
+        die("malloc");
+    }
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int t = 0; t < jobs; ++t) {
+        if (pthread_create(&tids[t], NULL, fleet_worker, fl) != 0) {
+            die("pthread_create");
+        }
+    }
+    for (int t = 0; t < jobs; ++t) {
+        pthread_join(tids[t], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    free(tids);
+
+    printf("validated %u image(s) with %d thread(s) in %.3fs: %u consistent, %u inconsistent, %u unreadable\n",
+           fl->npaths, jobs, secs, fl->counts[0], fl->counts[1], fl->counts[2]);
+    return fl->counts[0] == fl->npaths ? 0 : 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [--live] [image]\n"
+            "       %s [--live] [-j threads] <image|dir> ...\n"
+            "  --live  check a snapshot with committed journal transactions applied\n"
+            "  -j      threads checking images in parallel (default: online CPUs)\n"
+            "More than one image, a directory (its *.img files) or -j checks a fleet\n"
+            "and prints one summary line per image plus a total.\n",
+            prog, prog);
+}
+
+int main(int argc, char *argv[]) {
+    static struct fleet fl;
+    int live = 0;
+    int jobs = 0;
+    int fleet = 0;
+    fl.paths = malloc(MAX_IMAGES * sizeof(char *));
+    if (!fl.paths) {
+        die("malloc");
+    }
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--live") == 0) {
+            live = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+            fleet = 1;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            struct stat st;
+            if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+                fleet = 1;
+            }
+            add_path(&fl, argv[i]);
+        }
+    }
+    if (fl.npaths > 1) {
+        fleet = 1;
+    }
+    if (fleet) {
+        fl.live = live;
+        return run_fleet(&fl, jobs ? jobs : (int)sysconf(_SC_NPROCESSORS_ONLN));
+    }
+
+    static struct vbufs bufs;
+    struct vctx vc = {
+        .path = fl.npaths ? fl.paths[0] : DEFAULT_IMAGE,
+        .bufs = &bufs,
+        .out = stdout,
+        .err = stderr,
+    };
+    int rc = validate_image(&vc, live);
+    free(bufs.live_image);
+    if (rc == 0) {
+        printf("Filesystem '%s' is consistent.\n", vc.path);
+        return 0;
+    }
+    if (rc == 2) {
+        return 1;
+    }
+    fprintf(stderr, "%d inconsistencies found.\n", vc.error_count);
     return 1;
 }
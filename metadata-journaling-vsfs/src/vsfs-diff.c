@@ -0,0 +1,448 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE        4096U
+#define INODE_SIZE         128U
+#define JOURNAL_BLOCK_IDX    1U
+#define JOURNAL_BLOCKS      16U
+#define INODE_BLOCKS         2U
+#define DATA_BLOCKS         64U
+#define INODE_BMAP_IDX     (JOURNAL_BLOCK_IDX + JOURNAL_BLOCKS)
+#define DATA_BMAP_IDX      (INODE_BMAP_IDX + 1U)
+#define INODE_START_IDX    (DATA_BMAP_IDX + 1U)
+#define DATA_START_IDX     (INODE_START_IDX + INODE_BLOCKS)
+#define TOTAL_BLOCKS       (DATA_START_IDX + DATA_BLOCKS)
+#define INODES_PER_BLOCK   (BLOCK_SIZE / INODE_SIZE)
+#define INODE_COUNT        (INODE_BLOCKS * INODES_PER_BLOCK)
+#define DIRECT_POINTERS     8U
+
+#define MAX_THREADS 64
+
+struct superblock {
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t inode_count;
+
+    uint32_t journal_block;
+    uint32_t inode_bitmap;
+    uint32_t data_bitmap;
+    uint32_t inode_start;
+    uint32_t data_start;
+
+    uint32_t state;
+    uint32_t checkpoint_seq;
+    uint32_t install_gen;
+
+    uint8_t  _pad[128 - 12 * 4];
+};
+
+struct inode {
+    uint16_t type;
+    uint16_t links;
+    uint32_t size;
+
+    uint32_t direct[DIRECT_POINTERS];
+
+    uint32_t ctime;
+    uint32_t mtime;
+
+    uint8_t _pad[128 - (2 + 2 + 4 + DIRECT_POINTERS * 4 + 4 + 4)];
+};
+
+struct dirent {
+    uint32_t inode;
+    char name[28];
+};
+
+_Static_assert(sizeof(struct superblock) == 128, "superblock must be 128 bytes");
+_Static_assert(sizeof(struct inode) == 128, "inode must be 128 bytes");
+_Static_assert(sizeof(struct dirent) == 32, "dirent must be 32 bytes");
+
+struct image {
+    const char *path;
+    const uint8_t *map;
+    uint64_t size;   // bytes, including a partial trailing block
+    uint64_t blocks; // whole blocks
+    uint64_t *hashes;
+};
+
+static void die(const char *msg) {
+    perror(msg);
+    exit(2);
+}
+
+/* -------------------- hashing -------------------- */
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Four independent lanes over 32-byte stripes (the xxHash64 round). The lanes
+// carry no dependency on each other, so the inner loop vectorizes where the
+// target has 64-bit vector multiplies and pipelines well where it does not.
+static uint64_t block_hash(const uint8_t *p) {
+    uint64_t acc[4] = { PRIME64_1 + PRIME64_2, PRIME64_2, 0, (uint64_t)0 - PRIME64_1 };
+    for (uint32_t off = 0; off < BLOCK_SIZE; off += 32) {
+        for (int lane = 0; lane < 4; ++lane) {
+            uint64_t v;
+            memcpy(&v, p + off + lane * 8, sizeof(v));
+            acc[lane] = rotl64(acc[lane] + v * PRIME64_2, 31) * PRIME64_1;
+        }
+    }
+    uint64_t h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+struct hash_job {
+    struct image *img;
+    uint64_t first;
+    uint64_t last;
+};
+
+static void *hash_worker(void *arg) {
+    struct hash_job *job = arg;
+    for (uint64_t b = job->first; b < job->last; ++b) {
+        job->img->hashes[b] = block_hash(job->img->map + b * BLOCK_SIZE);
+    }
+    return NULL;
+}
+
+// Splits both images into one contiguous range per thread and hashes them all
+// at once; each thread streams through its own slice of the mapping.
+static void hash_images(struct image *imgs, int nimgs, int threads) {
+    pthread_t tids[2 * MAX_THREADS];
+    struct hash_job jobs[2 * MAX_THREADS];
+    int n = 0;
+    for (int i = 0; i < nimgs; ++i) {
+        uint64_t per = (imgs[i].blocks + (uint64_t)threads - 1) / (uint64_t)threads;
+        for (int t = 0; t < threads; ++t) {
+            uint64_t first = (uint64_t)t * per;
+            if (first >= imgs[i].blocks) {
+                break;
+            }
+            jobs[n].img = &imgs[i];
+            jobs[n].first = first;
+            jobs[n].last = first + per < imgs[i].blocks ? first + per : imgs[i].blocks;
+            if (pthread_create(&tids[n], NULL, hash_worker, &jobs[n]) != 0) {
+                die("pthread_create");
+            }
+            n++;
+        }
+    }
+    for (int i = 0; i < n; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+static void map_image(struct image *img) {
+    int fd = open(img->path, O_RDONLY);
+    if (fd < 0) {
+        die(img->path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        die("fstat");
+    }
+    img->size = (uint64_t)st.st_size;
+    img->blocks = img->size / BLOCK_SIZE;
+    img->map = NULL;
+    if (img->size > 0) {
+        img->map = mmap(NULL, img->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (img->map == MAP_FAILED) {
+            die("mmap");
+        }
+        // Separate calls: advice values are not flags.
+        madvise((void *)img->map, img->size, MADV_SEQUENTIAL);
+        madvise((void *)img->map, img->size, MADV_WILLNEED);
+    }
+    img->hashes = calloc(img->blocks ? img->blocks : 1, sizeof(uint64_t));
+    if (!img->hashes) {
+        die("calloc hashes");
+    }
+    close(fd);
+}
+
+/* -------------------- structural decoding -------------------- */
+
+static const uint8_t *block_of(const struct image *img, uint64_t b) {
+    return b < img->blocks ? img->map + b * BLOCK_SIZE : NULL;
+}
+
+static const struct inode *inode_of(const struct image *img, uint32_t inum) {
+    const uint8_t *blk = block_of(img, INODE_START_IDX + inum / INODES_PER_BLOCK);
+    return blk ? (const struct inode *)blk + inum % INODES_PER_BLOCK : NULL;
+}
+
+static int bit_of(const uint8_t *bitmap, uint32_t bit) {
+    return (bitmap[bit / 8] >> (bit % 8)) & 1;
+}
+
+#define DIFF_FIELD(label, fa, fb)                                                    \
+    do {                                                                             \
+        if ((fa) != (fb)) {                                                          \
+            printf("    %s: %u -> %u\n", label, (unsigned)(fa), (unsigned)(fb));     \
+        }                                                                            \
+    } while (0)
+
+static void decode_superblock(const uint8_t *a, const uint8_t *b) {
+    const struct superblock *sa = (const struct superblock *)a;
+    const struct superblock *sb = (const struct superblock *)b;
+    DIFF_FIELD("magic", sa->magic, sb->magic);
+    DIFF_FIELD("block_size", sa->block_size, sb->block_size);
+    DIFF_FIELD("total_blocks", sa->total_blocks, sb->total_blocks);
+    DIFF_FIELD("inode_count", sa->inode_count, sb->inode_count);
+    DIFF_FIELD("journal_block", sa->journal_block, sb->journal_block);
+    DIFF_FIELD("inode_bitmap", sa->inode_bitmap, sb->inode_bitmap);
+    DIFF_FIELD("data_bitmap", sa->data_bitmap, sb->data_bitmap);
+    DIFF_FIELD("inode_start", sa->inode_start, sb->inode_start);
+    DIFF_FIELD("data_start", sa->data_start, sb->data_start);
+    DIFF_FIELD("state", sa->state, sb->state);
+    DIFF_FIELD("checkpoint_seq", sa->checkpoint_seq, sb->checkpoint_seq);
+    DIFF_FIELD("install_gen", sa->install_gen, sb->install_gen);
+}
+
+static void decode_journal(uint64_t blk, const uint8_t *a, const uint8_t *b) {
+    if (blk == JOURNAL_BLOCK_IDX) {
+        uint32_t ha[2], hb[2];
+        memcpy(ha, a, sizeof(ha));
+        memcpy(hb, b, sizeof(hb));
+        DIFF_FIELD("journal magic", ha[0], hb[0]);
+        DIFF_FIELD("journal nbytes", ha[1], hb[1]);
+    }
+}
+
+static void decode_bitmap(const uint8_t *a, const uint8_t *b, uint32_t valid_bits, int is_inode) {
+    for (uint32_t bit = 0; bit < BLOCK_SIZE * 8; ++bit) {
+        if (bit_of(a, bit) == bit_of(b, bit)) {
+            continue;
+        }
+        if (bit >= valid_bits) {
+            printf("    stray bit %u: %d -> %d\n", bit, bit_of(a, bit), bit_of(b, bit));
+        } else if (is_inode) {
+            printf("    inode %u: %s\n", bit, bit_of(b, bit) ? "allocated" : "freed");
+        } else {
+            printf("    data block %u: %s\n", DATA_START_IDX + bit, bit_of(b, bit) ? "allocated" : "freed");
+        }
+    }
+}
+
+static void decode_inodes(uint64_t blk, const uint8_t *a, const uint8_t *b) {
+    const struct inode *ia = (const struct inode *)a;
+    const struct inode *ib = (const struct inode *)b;
+    for (uint32_t k = 0; k < INODES_PER_BLOCK; ++k) {
+        if (memcmp(&ia[k], &ib[k], sizeof(struct inode)) == 0) {
+            continue;
+        }
+        printf("    inode %u:\n", (uint32_t)(blk - INODE_START_IDX) * INODES_PER_BLOCK + k);
+        DIFF_FIELD("  type", ia[k].type, ib[k].type);
+        DIFF_FIELD("  links", ia[k].links, ib[k].links);
+        DIFF_FIELD("  size", ia[k].size, ib[k].size);
+        for (uint32_t d = 0; d < DIRECT_POINTERS; ++d) {
+            if (ia[k].direct[d] != ib[k].direct[d]) {
+                printf("      direct[%u]: %u -> %u\n", d, ia[k].direct[d], ib[k].direct[d]);
+            }
+        }
+        DIFF_FIELD("  ctime", ia[k].ctime, ib[k].ctime);
+        DIFF_FIELD("  mtime", ia[k].mtime, ib[k].mtime);
+        if (memcmp(ia[k]._pad, ib[k]._pad, sizeof(ia[k]._pad)) != 0) {
+            printf("      padding differs\n");
+        }
+    }
+}
+
+// Returns the directory inode that owns data block blk in img, or -1.
+static int dir_owner(const struct image *img, uint64_t blk) {
+    for (uint32_t i = 0; i < INODE_COUNT; ++i) {
+        const struct inode *ino = inode_of(img, i);
+        if (!ino || ino->type != 2) {
+            continue;
+        }
+        for (uint32_t d = 0; d < DIRECT_POINTERS; ++d) {
+            if (ino->direct[d] == blk) {
+                return (int)i;
+            }
+        }
+    }
+    return -1;
+}
+
+static void print_dirent(const struct dirent *de) {
+    if (de->inode == 0 && de->name[0] == '\0') {
+        printf("(empty)");
+    } else {
+        printf("'%.*s' -> inode %u", (int)sizeof(de->name), de->name, de->inode);
+    }
+}
+
+static void decode_data(const struct image *ia, const struct image *ib, uint64_t blk,
+                        const uint8_t *a, const uint8_t *b) {
+    int owner = dir_owner(ib, blk);
+    if (owner < 0) {
+        owner = dir_owner(ia, blk);
+    }
+    if (owner < 0) {
+        uint32_t bytes = 0;
+        for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+            bytes += a[i] != b[i];
+        }
+        printf("    file data: %u byte(s) differ\n", bytes);
+        return;
+    }
+    const struct dirent *da = (const struct dirent *)a;
+    const struct dirent *db = (const struct dirent *)b;
+    for (uint32_t e = 0; e < BLOCK_SIZE / sizeof(struct dirent); ++e) {
+        if (memcmp(&da[e], &db[e], sizeof(struct dirent)) == 0) {
+            continue;
+        }
+        printf("    dir inode %d entry %u: ", owner, e);
+        print_dirent(&da[e]);
+        printf(" => ");
+        print_dirent(&db[e]);
+        printf("\n");
+    }
+}
+
+static const char *region_of(uint64_t blk) {
+    if (blk == 0) return "superblock";
+    if (blk < INODE_BMAP_IDX) return "journal";
+    if (blk == INODE_BMAP_IDX) return "inode bitmap";
+    if (blk == DATA_BMAP_IDX) return "data bitmap";
+    if (blk < DATA_START_IDX) return "inode table";
+    if (blk < TOTAL_BLOCKS) return "data";
+    return "beyond layout";
+}
+
+static void decode_block(const struct image *ia, const struct image *ib, uint64_t blk) {
+    const uint8_t *a = block_of(ia, blk);
+    const uint8_t *b = block_of(ib, blk);
+    printf("block %llu (%s)%s\n", (unsigned long long)blk, region_of(blk),
+           !a ? ": only in second image" : !b ? ": only in first image" : "");
+    if (!a || !b) {
+        return;
+    }
+    if (blk == 0) {
+        decode_superblock(a, b);
+    } else if (blk < INODE_BMAP_IDX) {
+        decode_journal(blk, a, b);
+    } else if (blk == INODE_BMAP_IDX) {
+        decode_bitmap(a, b, INODE_COUNT, 1);
+    } else if (blk == DATA_BMAP_IDX) {
+        decode_bitmap(a, b, DATA_BLOCKS, 0);
+    } else if (blk < DATA_START_IDX) {
+        decode_inodes(blk, a, b);
+    } else if (blk < TOTAL_BLOCKS) {
+        decode_data(ia, ib, blk, a, b);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-q] <image-a> <image-b>\n"
+                    "  -j  hashing threads (default: online CPUs)\n"
+                    "  -q  list differing block numbers only, no decoding\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int quiet = 0;
+    struct image imgs[2];
+    int nimgs = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-q") == 0) {
+            quiet = 1;
+        } else if (argv[i][0] != '-' && nimgs < 2) {
+            imgs[nimgs++].path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (nimgs != 2) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+
+    map_image(&imgs[0]);
+    map_image(&imgs[1]);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    hash_images(imgs, 2, threads);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    uint64_t max_blocks = imgs[0].blocks > imgs[1].blocks ? imgs[0].blocks : imgs[1].blocks;
+    uint64_t differing = 0;
+    for (uint64_t b = 0; b < max_blocks; ++b) {
+        if (b < imgs[0].blocks && b < imgs[1].blocks && imgs[0].hashes[b] == imgs[1].hashes[b]) {
+            continue;
+        }
+        differing++;
+        if (quiet) {
+            printf("%llu\n", (unsigned long long)b);
+        } else {
+            decode_block(&imgs[0], &imgs[1], b);
+        }
+    }
+
+    // A partial trailing block is neither hashed nor decoded, but it is
+    // still part of the image, and so is its size.
+    const struct image *big = imgs[0].size > imgs[1].size ? &imgs[0] : &imgs[1];
+    uint64_t tail = big->size % BLOCK_SIZE;
+    if (imgs[0].size != imgs[1].size ||
+        (tail && memcmp(imgs[0].map + imgs[0].blocks * BLOCK_SIZE, imgs[1].map + imgs[1].blocks * BLOCK_SIZE, tail))) {
+        differing++;
+        if (!quiet) {
+            if (imgs[0].size != imgs[1].size) {
+                printf("image size: %llu -> %llu byte(s)\n", (unsigned long long)imgs[0].size,
+                       (unsigned long long)imgs[1].size);
+            }
+            if (tail) {
+                printf("block %llu (partial, %llu byte(s))\n", (unsigned long long)big->blocks,
+                       (unsigned long long)tail);
+            }
+        } else if (tail) {
+            printf("%llu\n", (unsigned long long)big->blocks);
+        }
+    }
+
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    double mib = (double)(imgs[0].blocks + imgs[1].blocks) * BLOCK_SIZE / (1024.0 * 1024.0);
+    fprintf(stderr, "vsfs-diff: %llu of %llu block(s) differ; hashed %.1f MiB in %.3fs (%.0f MiB/s, %d thread(s))\n",
+            (unsigned long long)differing, (unsigned long long)max_blocks, mib, secs,
+            secs > 0 ? mib / secs : 0.0, threads);
+
+    for (int i = 0; i < 2; ++i) {
+        if (imgs[i].map) {
+            munmap((void *)imgs[i].map, imgs[i].size);
+        }
+        free(imgs[i].hashes);
+    }
+    return differing ? 1 : 0;
+}